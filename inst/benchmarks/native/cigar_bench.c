@@ -0,0 +1,475 @@
+/****************************************************************************
+ *          Native benchmark driver for the core CIGAR kernels              *
+ *                                                                          *
+ * Times the R-independent kernels of src/cigar_core.c (tokenizer, extents, *
+ * ranges, projections, and trimming bounds) outside of R, so they can be   *
+ * profiled with perf, valgrind, etc. The corpora are loaded (or generated) *
+ * before timing starts and the kernels write to preallocated buffers, so   *
+ * nothing is allocated in the timed loops.                                 *
+ *                                                                          *
+ * Build from the root of the package source tree with:                     *
+ *                                                                          *
+ *   cc -O2 -o cigar_bench -Isrc src/cigar_core.c \                         *
+ *       inst/benchmarks/native/cigar_bench.c                               *
+ *                                                                          *
+ * Usage:                                                                   *
+ *                                                                          *
+ *   cigar_bench [-n NCIGARS] [-r NREPS] [-s SEED] [FILE ...]               *
+ *                                                                          *
+ * Without FILE, runs on 3 synthetic corpora of NCIGARS CIGAR strings each  *
+ * (the "long" corpus is 100 times smaller). A FILE contains either one     *
+ * CIGAR string per line, or SAM records (the CIGAR is then taken from the  *
+ * 6th field and the header lines are skipped).                             *
+ *                                                                          *
+ * Output is one tab-separated line per corpus and kernel, preceded by a    *
+ * header line. The reported time is the best of NREPS runs. The 'nops'     *
+ * column is the number of CIGAR operations the kernel actually visits per  *
+ * run (the projection kernels stop at query/reference position 50), and    *
+ * is what the ops/s rate is based on.                                      *
+ ****************************************************************************/
+#define _POSIX_C_SOURCE 200809L  /* for getline() and clock_gettime() */
+
+#include "cigar_core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+/****************************************************************************
+ * Corpora
+ *
+ * All the CIGAR strings of a corpus are stored nul-terminated and back to
+ * back in a single buffer.
+ */
+
+typedef struct corpus_t {
+	const char *name;
+	char *buf;
+	size_t buf_len, buf_size;
+	size_t *offsets;
+	int n, size;
+	long long nops;
+	int max_nops;
+} Corpus;
+
+static void *xrealloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if (p == NULL) {
+		fprintf(stderr, "cigar_bench: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static void append_cigar(Corpus *corpus, const char *cigar, size_t len)
+{
+	if (corpus->buf_len + len + 1 > corpus->buf_size) {
+		corpus->buf_size = 2 * (corpus->buf_len + len + 1);
+		corpus->buf = xrealloc(corpus->buf, corpus->buf_size);
+	}
+	if (corpus->n == corpus->size) {
+		corpus->size = corpus->size == 0 ? 1024 : 2 * corpus->size;
+		corpus->offsets = xrealloc(corpus->offsets,
+					   corpus->size * sizeof(size_t));
+	}
+	memcpy(corpus->buf + corpus->buf_len, cigar, len);
+	corpus->buf[corpus->buf_len + len] = '\0';
+	corpus->offsets[corpus->n++] = corpus->buf_len;
+	corpus->buf_len += len + 1;
+}
+
+static const char *get_cigar(const Corpus *corpus, int i)
+{
+	return corpus->buf + corpus->offsets[i];
+}
+
+/* Drops the CIGARs that cannot be parsed, and computes 'nops' and
+   'max_nops'. */
+static void finalize_corpus(Corpus *corpus)
+{
+	int n = 0;
+	corpus->nops = corpus->max_nops = 0;
+	for (int i = 0; i < corpus->n; i++) {
+		const char *cigar = get_cigar(corpus, i);
+		int offset = 0, nops = 0, k, OPL;
+		char OP;
+		while ((k = _next_cigar_OP(cigar, offset, &OP, &OPL)) > 0) {
+			offset += k;
+			nops++;
+		}
+		if (k == -1 || nops == 0)
+			continue;
+		corpus->offsets[n++] = corpus->offsets[i];
+		corpus->nops += nops;
+		if (nops > corpus->max_nops)
+			corpus->max_nops = nops;
+	}
+	if (n < corpus->n)
+		fprintf(stderr, "cigar_bench: %s: dropped %d invalid CIGARs\n",
+			corpus->name, corpus->n - n);
+	corpus->n = n;
+}
+
+static void free_corpus(Corpus *corpus)
+{
+	free(corpus->buf);
+	free(corpus->offsets);
+}
+
+
+/****************************************************************************
+ * Synthetic corpora
+ */
+
+static unsigned long long rng_state;
+
+/* xorshift64* */
+static unsigned int rng(unsigned int n)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (unsigned int) ((rng_state * 2685821657736338717ULL) >> 33) % n;
+}
+
+static char *put_op(char *p, int OPL, char OP)
+{
+	return p + sprintf(p, "%d%c", OPL, OP);
+}
+
+/* 100-150bp genomic reads: mostly "<n>M", sometimes with soft clipping or
+   a small indel. */
+static void gen_short_read(char *p)
+{
+	int qlen = 100 + rng(51);
+	if (rng(5) == 0) {
+		int s = 1 + rng(20);
+		p = put_op(p, s, 'S');
+		qlen -= s;
+	}
+	if (rng(10) == 0) {
+		int m = 10 + rng(qlen - 20);
+		p = put_op(p, m, 'M');
+		p = put_op(p, 1 + rng(5), rng(2) ? 'I' : 'D');
+		qlen -= m;
+	}
+	put_op(p, qlen, 'M');
+}
+
+/* RNA-seq reads spanning 1 to 5 introns. */
+static void gen_spliced_read(char *p)
+{
+	int nexons = 2 + rng(5);
+	for (int i = 0; i < nexons; i++) {
+		if (i != 0)
+			p = put_op(p, 50 + rng(50000), 'N');
+		p = put_op(p, 5 + rng(60), 'M');
+	}
+}
+
+/* Long reads with frequent small indels and mismatches, using the
+   extended CIGAR operations. */
+static void gen_long_read(char *p, int nops)
+{
+	static const char ops[] = "=X=I=D";
+	for (int i = 0; i < nops; i++)
+		p = put_op(p, 1 + rng(i % 2 == 0 ? 200 : 5), ops[i % 6]);
+}
+
+static void make_synthetic_corpus(Corpus *corpus, const char *name, int n)
+{
+	static char cigar[16384];
+	memset(corpus, 0, sizeof(Corpus));
+	corpus->name = name;
+	for (int i = 0; i < n; i++) {
+		if (strcmp(name, "short") == 0)
+			gen_short_read(cigar);
+		else if (strcmp(name, "spliced") == 0)
+			gen_spliced_read(cigar);
+		else
+			gen_long_read(cigar, 1000 + rng(1000));
+		append_cigar(corpus, cigar, strlen(cigar));
+	}
+	finalize_corpus(corpus);
+}
+
+
+/****************************************************************************
+ * File-based corpora
+ */
+
+static int read_corpus(Corpus *corpus, const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "cigar_bench: cannot open '%s'\n", path);
+		return -1;
+	}
+	memset(corpus, 0, sizeof(Corpus));
+	corpus->name = path;
+	char *line = NULL;
+	size_t line_size = 0;
+	while (getline(&line, &line_size, fp) != -1) {
+		if (line[0] == '@')
+			continue;
+		char *start = line, *end;
+		if (strchr(line, '\t') != NULL) {
+			/* SAM record: CIGAR is the 6th field. */
+			for (int j = 0; j < 5 && start != NULL; j++) {
+				start = strchr(start, '\t');
+				if (start != NULL)
+					start++;
+			}
+			if (start == NULL)
+				continue;
+			end = strchr(start, '\t');
+			if (end == NULL)
+				end = start + strcspn(start, "\r\n");
+		} else {
+			end = start + strcspn(start, "\r\n");
+		}
+		if (end == start || (end - start == 1 && *start == '*'))
+			continue;
+		append_cigar(corpus, start, end - start);
+	}
+	free(line);
+	fclose(fp);
+	finalize_corpus(corpus);
+	return 0;
+}
+
+
+/****************************************************************************
+ * Kernels
+ *
+ * Each kernel walks the whole corpus once and returns a checksum that is
+ * accumulated by the caller so the compiler cannot drop the work.
+ */
+
+typedef struct bufs_t {
+	char *OPs;
+	int *OPLs;
+	int *starts, *widths;
+	int buflen;
+} Bufs;
+
+typedef long long (*KernelFun)(const Corpus *, Bufs *);
+
+static long long k_tokenize(const Corpus *corpus, Bufs *bufs)
+{
+	(void) bufs;
+	long long sum = 0;
+	for (int i = 0; i < corpus->n; i++) {
+		const char *cigar = get_cigar(corpus, i);
+		int offset = 0, n, OPL;
+		char OP;
+		while ((n = _next_cigar_OP(cigar, offset, &OP, &OPL)) > 0) {
+			sum += OPL;
+			offset += n;
+		}
+	}
+	return sum;
+}
+
+static long long k_split(const Corpus *corpus, Bufs *bufs)
+{
+	long long sum = 0;
+	for (int i = 0; i < corpus->n; i++) {
+		int nops;
+		_split_cigar(get_cigar(corpus, i),
+			     bufs->OPs, bufs->OPLs, bufs->buflen, &nops);
+		sum += nops;
+	}
+	return sum;
+}
+
+static long long extent(const Corpus *corpus, int space)
+{
+	long long sum = 0, x;
+	for (int i = 0; i < corpus->n; i++) {
+		_cigar_extent(get_cigar(corpus, i), space, &x);
+		sum += x;
+	}
+	return sum;
+}
+
+static long long k_extent_ref(const Corpus *corpus, Bufs *bufs)
+{
+	(void) bufs;
+	return extent(corpus, REFERENCE);
+}
+
+static long long k_extent_query(const Corpus *corpus, Bufs *bufs)
+{
+	(void) bufs;
+	return extent(corpus, QUERY);
+}
+
+static long long k_ranges_ref(const Corpus *corpus, Bufs *bufs)
+{
+	long long sum = 0;
+	for (int i = 0; i < corpus->n; i++) {
+		int nranges;
+		_cigar_ranges(get_cigar(corpus, i), REFERENCE, 1, NULL, 1, 0,
+			      bufs->starts, bufs->widths, bufs->buflen,
+			      &nranges);
+		sum += nranges;
+	}
+	return sum;
+}
+
+static long long k_query_to_ref(const Corpus *corpus, Bufs *bufs)
+{
+	(void) bufs;
+	long long sum = 0;
+	for (int i = 0; i < corpus->n; i++)
+		sum += _query_pos_as_ref_pos(50, get_cigar(corpus, i), 1, 0);
+	return sum;
+}
+
+static long long k_ref_to_query(const Corpus *corpus, Bufs *bufs)
+{
+	(void) bufs;
+	long long sum = 0;
+	for (int i = 0; i < corpus->n; i++)
+		sum += _ref_pos_as_query_pos(50, get_cigar(corpus, i), 1, 0);
+	return sum;
+}
+
+static long long k_trim_query(const Corpus *corpus, Bufs *bufs)
+{
+	long long sum = 0;
+	for (int i = 0; i < corpus->n; i++) {
+		int nops, Lnpos = 2, Rnpos = 2, Lidx, Ridx, rshift;
+		_split_cigar(get_cigar(corpus, i),
+			     bufs->OPs, bufs->OPLs, bufs->buflen, &nops);
+		if (_get_trim_bounds(bufs->OPs, bufs->OPLs, nops, 1,
+				     &Lnpos, &Lidx, &Rnpos, &Ridx,
+				     &rshift) == NULL)
+			sum += Ridx - Lidx + rshift;
+	}
+	return sum;
+}
+
+static const struct {
+	const char *name;
+	KernelFun fun;
+} kernels[] = {
+	{"tokenize",     k_tokenize},
+	{"split",        k_split},
+	{"extent_ref",   k_extent_ref},
+	{"extent_query", k_extent_query},
+	{"ranges_ref",   k_ranges_ref},
+	{"query_to_ref", k_query_to_ref},
+	{"ref_to_query", k_ref_to_query},
+	{"trim_query",   k_trim_query},
+};
+#define NKERNELS ((int) (sizeof(kernels) / sizeof(kernels[0])))
+
+
+/****************************************************************************
+ * Driver
+ */
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+static long long checksum;
+
+/* Counts the CIGAR operations visited by 1 run of the kernel, using the
+   instrumentation counters of src/cigar_core.c. */
+static long long count_visited_ops(KernelFun fun, const Corpus *corpus,
+				   Bufs *bufs)
+{
+	long long nops0 = _stats_counters[STATS_OPS];
+	_stats_enabled = 1;
+	checksum += fun(corpus, bufs);
+	_stats_enabled = 0;
+	return _stats_counters[STATS_OPS] - nops0;
+}
+
+static void bench_corpus(const Corpus *corpus, int nreps)
+{
+	Bufs bufs;
+	bufs.buflen = corpus->max_nops;
+	bufs.OPs = xrealloc(NULL, bufs.buflen);
+	bufs.OPLs = xrealloc(NULL, bufs.buflen * sizeof(int));
+	bufs.starts = xrealloc(NULL, bufs.buflen * sizeof(int));
+	bufs.widths = xrealloc(NULL, bufs.buflen * sizeof(int));
+	for (int k = 0; k < NKERNELS; k++) {
+		long long nops = count_visited_ops(kernels[k].fun, corpus,
+						   &bufs);
+		double best = -1.0;
+		for (int r = 0; r < nreps; r++) {
+			double t0 = now();
+			checksum += kernels[k].fun(corpus, &bufs);
+			double dt = now() - t0;
+			if (best < 0.0 || dt < best)
+				best = dt;
+		}
+		printf("%s\t%s\t%d\t%lld\t%d\t%.6f\t%.2f\t%.2f\n",
+		       corpus->name, kernels[k].name, corpus->n, nops,
+		       nreps, best, corpus->n / best / 1e6,
+		       nops / best / 1e6);
+	}
+	free(bufs.OPs);
+	free(bufs.OPLs);
+	free(bufs.starts);
+	free(bufs.widths);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: cigar_bench [-n NCIGARS] [-r NREPS] "
+			"[-s SEED] [FILE ...]\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int n = 1000000, nreps = 5, i;
+	rng_state = 20250912;
+	for (i = 1; i < argc && argv[i][0] == '-'; i += 2) {
+		if (i + 1 >= argc)
+			usage();
+		if (strcmp(argv[i], "-n") == 0)
+			n = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-r") == 0)
+			nreps = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-s") == 0)
+			rng_state = strtoull(argv[i + 1], NULL, 10);
+		else
+			usage();
+	}
+	if (n <= 0 || nreps <= 0 || rng_state == 0)
+		usage();
+
+	printf("corpus\tkernel\tncigars\tnops\treps\tseconds\t"
+	       "Mcigars_per_sec\tMops_per_sec\n");
+	Corpus corpus;
+	if (i == argc) {
+		static const char *names[] = {"short", "spliced", "long"};
+		for (int j = 0; j < 3; j++) {
+			int ncigars = j == 2 ? (n + 99) / 100 : n;
+			make_synthetic_corpus(&corpus, names[j], ncigars);
+			bench_corpus(&corpus, nreps);
+			free_corpus(&corpus);
+		}
+	}
+	for ( ; i < argc; i++) {
+		if (read_corpus(&corpus, argv[i]) != 0)
+			return EXIT_FAILURE;
+		if (corpus.n != 0)
+			bench_corpus(&corpus, nreps);
+		free_corpus(&corpus);
+	}
+	fprintf(stderr, "checksum: %lld\n", checksum);
+	return 0;
+}
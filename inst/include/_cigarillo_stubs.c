@@ -0,0 +1,64 @@
+#include "cigarillo_interface.h"
+
+#define DEFINE_CCALLABLE_STUB(retT, stubname, Targs, args) \
+typedef retT(*__ ## stubname ## _funtype__)Targs; \
+retT stubname Targs \
+{ \
+	static __ ## stubname ## _funtype__ fun = NULL; \
+	if (fun == NULL) \
+		fun = (__ ## stubname ## _funtype__) R_GetCCallable("cigarillo", "_" #stubname); \
+	return fun args; \
+}
+
+
+/*
+ * Stubs for callables defined in explode_cigars.c
+ */
+
+DEFINE_CCALLABLE_STUB(int, next_cigar_OP,
+	(const char *cigar_string, int offset, char *OP, int *OPL),
+	(            cigar_string,     offset,       OP,      OPL)
+)
+
+DEFINE_CCALLABLE_STUB(const char *, get_cigar_parsing_error,
+	(void),
+	()
+)
+
+DEFINE_CCALLABLE_STUB(const char *, split_cigar,
+	(const char *cigar_string, char *OPs, int *OPLs, int buflen, int *nops),
+	(            cigar_string,       OPs,      OPLs,     buflen,      nops)
+)
+
+/*
+ * Stubs for callables defined in cigar_extent.c
+ */
+
+DEFINE_CCALLABLE_STUB(const char *, cigar_extent,
+	(const char *cigar_string, int space, long long *extent),
+	(            cigar_string,     space,            extent)
+)
+
+/*
+ * Stubs for callables defined in project_positions.c
+ */
+
+DEFINE_CCALLABLE_STUB(int, query_pos_as_ref_pos,
+	(int query_pos, const char *cigar_string, int lmmpos, int narrow_left),
+	(    query_pos,              cigar_string,     lmmpos,     narrow_left)
+)
+
+DEFINE_CCALLABLE_STUB(int, ref_pos_as_query_pos,
+	(int ref_pos, const char *cigar_string, int lmmpos, int narrow_left),
+	(    ref_pos,              cigar_string,     lmmpos,     narrow_left)
+)
+
+/*
+ * Stubs for callables defined in cigars_as_ranges.c
+ */
+
+DEFINE_CCALLABLE_STUB(const char *, cigar_ranges,
+	(const char *cigar_string, int space, int lmmpos, const char *ops, int drop_empty_ranges, int reduce_ranges, int *starts, int *widths, int buflen, int *nranges),
+	(            cigar_string,     space,     lmmpos,             ops,     drop_empty_ranges,     reduce_ranges,      starts,      widths,     buflen,      nranges)
+)
+
@@ -0,0 +1,29 @@
+/*****************************************************************************
+ cigarillo C interface: typedefs and defines
+ -------------------------------------------
+
+   The cigarillo C interface is split in 2 files:
+     1. cigarillo_defines.h (this file): contains the typedefs and defines
+        of the interface.
+     2. cigarillo_interface.h (in this directory): contains the prototypes
+        of the cigarillo C routines that are part of the interface.
+
+ *****************************************************************************/
+#ifndef CIGARILLO_DEFINES_H
+#define CIGARILLO_DEFINES_H
+
+#include <Rinternals.h>  /* for NA_INTEGER */
+#include <R_ext/Rdynload.h>  /* for R_GetCCallable() */
+
+/* The 8 "projection spaces". Must be kept in sync with the codes defined
+   in src/cigar_core.h. */
+#define CIGARILLO_REFERENCE                       1
+#define CIGARILLO_REFERENCE_N_REGIONS_REMOVED     2
+#define CIGARILLO_QUERY                           3
+#define CIGARILLO_QUERY_BEFORE_HARD_CLIPPING      4
+#define CIGARILLO_QUERY_AFTER_SOFT_CLIPPING       5
+#define CIGARILLO_PAIRWISE                        6
+#define CIGARILLO_PAIRWISE_N_REGIONS_REMOVED      7
+#define CIGARILLO_PAIRWISE_DENSE                  8
+
+#endif
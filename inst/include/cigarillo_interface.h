@@ -0,0 +1,122 @@
+/*****************************************************************************
+ cigarillo C interface: prototypes
+ ---------------------------------
+
+   The cigarillo C interface is split in 2 files:
+     1. cigarillo_defines.h (in this directory): contains the typedefs and
+        defines of the interface.
+     2. cigarillo_interface.h (this file): contains the prototypes of the
+        cigarillo C routines that are part of the interface.
+
+   To use the cigarillo C interface in your package:
+     - Add cigarillo to the LinkingTo field of your DESCRIPTION file.
+     - Copy _cigarillo_stubs.c (from this directory) to your src/ folder
+       (or add a file that #includes it).
+     - #include "cigarillo_interface.h" in the .c files that need it.
+
+   None of the routines below uses the R API: they work on nul-terminated
+   CIGAR strings and write to buffers provided by the caller, so they can
+   be called from a tight C loop without any SEXP allocation.
+   The routines that can fail return NULL on success or a pointer to an
+   error message. The message lives in a static buffer that is overwritten
+   by the next call, so copy it if you need to keep it.
+
+ *****************************************************************************/
+#ifndef CIGARILLO_INTERFACE_H
+#define CIGARILLO_INTERFACE_H
+
+#include "cigarillo_defines.h"
+
+
+/*
+ * Parsing CIGAR strings
+ * (see src/cigar_core.c in the cigarillo package)
+ */
+
+/* Extracts the CIGAR operation that starts at 'offset' in 'cigar_string'.
+   Returns the number of chars that were read, 0 if the end of the string
+   was reached, or -1 in case of a parse error (in which case
+   get_cigar_parsing_error() returns the error message). Zero-length
+   operations are skipped. */
+int next_cigar_OP(
+	const char *cigar_string,
+	int offset,
+	char *OP,
+	int *OPL
+);
+
+const char *get_cigar_parsing_error(void);
+
+/* Splits 'cigar_string' into its operations and their lengths. At most
+   'buflen' operations are written to 'OPs' and 'OPLs', but '*nops' is
+   always set to the total number of operations, so the caller can grow
+   its buffers and call again when '*nops' > 'buflen'. */
+const char *split_cigar(
+	const char *cigar_string,
+	char *OPs,
+	int *OPLs,
+	int buflen,
+	int *nops
+);
+
+
+/*
+ * CIGAR extents
+ * (see src/cigar_core.c in the cigarillo package)
+ */
+
+/* 'space' must be one of the CIGARILLO_* space codes defined in
+   cigarillo_defines.h. */
+const char *cigar_extent(
+	const char *cigar_string,
+	int space,
+	long long *extent
+);
+
+
+/*
+ * Projecting positions
+ * (see src/cigar_core.c in the cigarillo package)
+ */
+
+/* Return NA_INTEGER if the position cannot be projected or if the CIGAR
+   string cannot be parsed. */
+int query_pos_as_ref_pos(
+	int query_pos,
+	const char *cigar_string,
+	int lmmpos,
+	int narrow_left
+);
+
+int ref_pos_as_query_pos(
+	int ref_pos,
+	const char *cigar_string,
+	int lmmpos,
+	int narrow_left
+);
+
+
+/*
+ * Turning CIGAR strings into ranges
+ * (see src/cigar_core.c in the cigarillo package)
+ */
+
+/* Writes the ranges of the CIGAR operations along 'space' to 'starts'
+   and 'widths'. Only the operations listed in 'ops' (a nul-terminated
+   string of CIGAR operation letters, or NULL for all operations) produce
+   a range. Like with split_cigar(), at most 'buflen' ranges are written
+   but '*nranges' is always set to the total number of ranges. */
+const char *cigar_ranges(
+	const char *cigar_string,
+	int space,
+	int lmmpos,
+	const char *ops,
+	int drop_empty_ranges,
+	int reduce_ranges,
+	int *starts,
+	int *widths,
+	int buflen,
+	int *nranges
+);
+
+#endif
@@ -1,16 +1,31 @@
 #include <R_ext/Rdynload.h>
 
+#include "cigar_core.h"
 #include "cigar_ops_visibility.h"
 #include "explode_cigars.h"
+#include "implode_cigars.h"
+#include "bam_cigars.h"
 #include "tabulate_cigar_ops.h"
 #include "cigar_extent.h"
 #include "trim_cigars.h"
+#include "softclip_cigars.h"
+#include "mate_pairs.h"
+#include "left_align_indels.h"
 #include "cigars_as_ranges.h"
+#include "cigar_density.h"
+#include "cigar_chunks.h"
+#include "read_sam.h"
+#include "cigar_store.h"
 #include "project_positions.h"
 #include "map_ref_ranges_to_query.h"
+#include "cigarillo_stats.h"
+#include "test_ccallables.h"
 
 #define CALLMETHOD_DEF(fun, numArgs) {#fun, (DL_FUNC) &fun, numArgs}
 
+#define REGISTER_CCALLABLE(fun) \
+	R_RegisterCCallable("cigarillo", #fun, (DL_FUNC) &fun)
+
 static const R_CallMethodDef callMethods[] = {
 
 /* cigar_ops_visibility.c */
@@ -18,21 +33,61 @@ static const R_CallMethodDef callMethods[] = {
 
 /* explode_cigars.c */
 	CALLMETHOD_DEF(C_validate_cigars, 2),
-	CALLMETHOD_DEF(C_explode_cigar_ops, 2),
-	CALLMETHOD_DEF(C_explode_cigar_oplens, 2),
+	CALLMETHOD_DEF(C_explode_cigar_ops, 3),
+	CALLMETHOD_DEF(C_explode_cigar_oplens, 3),
+
+/* implode_cigars.c */
+	CALLMETHOD_DEF(C_implode_cigars, 5),
+	CALLMETHOD_DEF(C_decode_cigar_words, 1),
+
+/* bam_cigars.c */
+	CALLMETHOD_DEF(C_encode_bam_cigars, 1),
+	CALLMETHOD_DEF(C_decode_bam_cigars, 1),
 
 /* tabulate_cigar_ops.c */
-	CALLMETHOD_DEF(C_tabulate_cigar_ops, 2),
+	CALLMETHOD_DEF(C_tabulate_cigar_ops, 3),
+	CALLMETHOD_DEF(C_tabulate_cigar_ops_by_group, 5),
+	CALLMETHOD_DEF(C_tabulate_cigar_oplens, 5),
 
 /* cigar_extent.c */
-	CALLMETHOD_DEF(C_cigar_extent, 3),
+	CALLMETHOD_DEF(C_cigar_extent, 4),
+	CALLMETHOD_DEF(C_lazy_cigar_extent, 4),
 
 /* trim_cigars.c */
-	CALLMETHOD_DEF(C_trim_cigars_along_ref, 3),
-	CALLMETHOD_DEF(C_trim_cigars_along_query, 3),
+	CALLMETHOD_DEF(C_trim_cigars_along_ref, 4),
+	CALLMETHOD_DEF(C_trim_cigars_along_query, 4),
+	CALLMETHOD_DEF(C_slice_alignments, 5),
+	CALLMETHOD_DEF(C_trim_alignments_by_quality, 8),
+
+/* softclip_cigars.c */
+	CALLMETHOD_DEF(C_softclip_cigars_along_ref, 4),
+	CALLMETHOD_DEF(C_softclip_cigars_along_query, 4),
+
+/* mate_pairs.c */
+	CALLMETHOD_DEF(C_clip_mate_overlaps, 8),
+	CALLMETHOD_DEF(C_fragment_extents, 12),
+
+/* left_align_indels.c */
+	CALLMETHOD_DEF(C_left_align_indels, 6),
 
 /* cigars_as_ranges.c */
-	CALLMETHOD_DEF(C_cigars_as_ranges, 10),
+	CALLMETHOD_DEF(C_cigars_as_ranges, 11),
+
+/* cigar_density.c */
+	CALLMETHOD_DEF(C_bin_cigar_ops_along_ref, 7),
+
+/* cigar_chunks.c */
+	CALLMETHOD_DEF(C_plan_cigar_chunks, 3),
+
+/* read_sam.c */
+	CALLMETHOD_DEF(C_read_sam_columns, 5),
+
+/* cigar_store.c */
+	CALLMETHOD_DEF(C_write_cigar_store, 4),
+	CALLMETHOD_DEF(C_open_cigar_store, 1),
+	CALLMETHOD_DEF(C_close_cigar_store, 1),
+	CALLMETHOD_DEF(C_cigar_store_length, 1),
+	CALLMETHOD_DEF(C_cigar_store_column, 2),
 
 /* project_positions.c */
 	CALLMETHOD_DEF(C_query_pos_as_ref_pos, 4),
@@ -41,6 +96,14 @@ static const R_CallMethodDef callMethods[] = {
 /* map_ref_ranges_to_query.c */
 	CALLMETHOD_DEF(C_map_ref_ranges_to_query, 4),
 
+/* cigarillo_stats.c */
+	CALLMETHOD_DEF(C_stats_begin, 1),
+	CALLMETHOD_DEF(C_stats_end, 3),
+	CALLMETHOD_DEF(C_get_cigarillo_stats, 1),
+
+/* test_ccallables.c */
+	CALLMETHOD_DEF(C_test_ccallables, 2),
+
 	{NULL, NULL, 0}
 };
 
@@ -48,6 +111,19 @@ void R_init_cigarillo(DllInfo *info)
 {
 	R_registerRoutines(info, NULL, callMethods, NULL, NULL);
 	R_useDynamicSymbols(info, 0);
+
+/* cigar_extent.c */
+	_init_lazy_extents_class(info);
+
+/* cigar_core.c */
+	REGISTER_CCALLABLE(_next_cigar_OP);
+	REGISTER_CCALLABLE(_get_cigar_parsing_error);
+	REGISTER_CCALLABLE(_split_cigar);
+	REGISTER_CCALLABLE(_cigar_extent);
+	REGISTER_CCALLABLE(_query_pos_as_ref_pos);
+	REGISTER_CCALLABLE(_ref_pos_as_query_pos);
+	REGISTER_CCALLABLE(_cigar_ranges);
+
 	return;
 }
 
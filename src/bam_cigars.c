@@ -0,0 +1,264 @@
+#include "bam_cigars.h"
+
+#include "IRanges_interface.h"
+#include "S4Vectors_interface.h"
+
+#include "cigar_ops_visibility.h"
+#include "implode_cigars.h"
+#include "cigar_store.h"
+
+#include <string.h>  /* for memset(), strchr(), strcmp() */
+#include <limits.h>  /* for INT_MAX */
+
+
+/*
+ * In a BAM record, the CIGAR is stored as an array of uint32 words, one
+ * per CIGAR operation, with the operation length in the 28 high bits and
+ * the index of the operation in "MIDNSHP=X" in the 4 low bits. The words
+ * are stored in little-endian byte order.
+ * On the R side, a vector of BAM-encoded CIGARs is represented by a
+ * CompressedRawList object where each list element contains the bytes of
+ * the words of a CIGAR. A zero-length list element represents a CIGAR
+ * that is not available (i.e. "*").
+ */
+
+#define MAX_BAM_OPL ((1 << 28) - 1)
+
+static const char bamOPs[] = "MIDNSHP=X";
+
+
+/****************************************************************************
+ * CigarsHolder
+ */
+
+CigarsHolder _new_CigarsHolder(SEXP cigars)
+{
+	CigarsHolder x;
+
+	memset(&x, 0, sizeof(x));
+	x.strings = R_NilValue;
+	if (TYPEOF(cigars) == STRSXP) {
+		x.strings = cigars;
+		x.length = XLENGTH(cigars);
+		return x;
+	}
+	const CigarStore *store = _get_CigarStore(cigars);
+	if (store != NULL) {
+		x.bytes = store->words;
+		x.ends64 = store->ends;
+		x.nwords = store->nwords;
+		x.ref_extents = store->ref_extents;
+		x.query_extents = store->query_extents;
+		x.length = (R_xlen_t) store->nalign;
+		return x;
+	}
+	SEXP unlisted = get_CompressedList_unlistData(cigars);
+	SEXP partitioning = get_CompressedList_partitioning(cigars);
+	x.bytes = RAW(unlisted);
+	x.ends = INTEGER(get_PartitioningByEnd_end(partitioning));
+	x.length = get_CompressedList_length(cigars);
+	return x;
+}
+
+/* Returns 0 if the CIGAR is NA, and 1 otherwise. Note that a BAM-encoded
+   CIGAR is never NA. */
+int _get_cigar(const CigarsHolder *x, R_xlen_t i, Cigar *cigar)
+{
+	if (x->strings != R_NilValue) {
+		SEXP cigars_elt = STRING_ELT(x->strings, i);
+		if (cigars_elt == NA_STRING)
+			return 0;
+		cigar->string = CHAR(cigars_elt);
+		cigar->words = NULL;
+		cigar->nwords = 0;
+		return 1;
+	}
+	cigar->string = NULL;
+	if (x->ends64 != NULL) {
+		/* The ends come from a file so we don't trust them. */
+		long long start = i == 0 ? 0 : x->ends64[i - 1];
+		long long end = x->ends64[i];
+		if (start < 0 || end < start || end > x->nwords ||
+		    end - start > INT_MAX)
+			error("CIGAR store file is corrupted");
+		cigar->words = x->bytes + 4 * start;
+		cigar->nwords = (int) (end - start);
+		return 1;
+	}
+	int start = i == 0 ? 0 : x->ends[i - 1];
+	cigar->words = x->bytes + start;
+	cigar->nwords = (x->ends[i] - start) / 4;
+	return 1;
+}
+
+int _cigar_is_star(const Cigar *cigar)
+{
+	if (cigar->string != NULL)
+		return strcmp(cigar->string, "*") == 0;
+	return cigar->nwords == 0;
+}
+
+/* A CigarStore object comes with the extents along the reference and query
+   spaces precomputed. Returns NULL if they are not available for 'space'.
+   The extent of a "*" CIGAR is NA. */
+const int *_get_precomputed_extents(const CigarsHolder *x, int space)
+{
+	if (space == REFERENCE)
+		return x->ref_extents;
+	if (space == QUERY)
+		return x->query_extents;
+	return NULL;
+}
+
+
+/****************************************************************************
+ * C_encode_bam_cigars()
+ */
+
+/* Returns the number of words needed to encode 'cigar_string', or -1 if
+   it cannot be encoded (in which case '*errmsg' is set). */
+static int count_words(const char *cigar_string, const char **errmsg)
+{
+	int offset = 0, op_idx = 0, n, OPL;
+	char OP;
+
+	if (strcmp(cigar_string, "*") == 0)
+		return 0;
+	while ((n = _next_cigar_OP(cigar_string, offset, &OP, &OPL))) {
+		if (n == -1) {
+			*errmsg = _get_cigar_parsing_error();
+			return -1;
+		}
+		if (strchr(bamOPs, (int) OP) == NULL) {
+			*errmsg = _unknown_cigar_op_error(OP, op_idx);
+			return -1;
+		}
+		if (OPL > MAX_BAM_OPL) {
+			*errmsg = "operation length is too big for BAM encoding";
+			return -1;
+		}
+		offset += n;
+		op_idx++;
+	}
+	return op_idx;
+}
+
+static unsigned char *write_words(const char *cigar_string,
+		unsigned char *out)
+{
+	int offset = 0, n, OPL;
+	char OP;
+
+	if (strcmp(cigar_string, "*") == 0)
+		return out;
+	while ((n = _next_cigar_OP(cigar_string, offset, &OP, &OPL))) {
+		unsigned int word = (unsigned int) OPL << 4 |
+				    (unsigned int) (strchr(bamOPs, (int) OP) -
+						    bamOPs);
+		*(out++) = word & 0xff;
+		*(out++) = (word >> 8) & 0xff;
+		*(out++) = (word >> 16) & 0xff;
+		*(out++) = word >> 24;
+		offset += n;
+	}
+	return out;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   cigars: character vector containing CIGAR strings.
+ * Returns a CompressedRawList object of the same length as 'cigars'
+ * containing the BAM-encoded CIGARs. NAs and "*" produce zero-length list
+ * elements.
+ */
+SEXP C_encode_bam_cigars(SEXP cigars)
+{
+	R_xlen_t ncigars = XLENGTH(cigars);
+	if (ncigars > INT_MAX)
+		_too_many_elements_error("the returned list");
+	const char *errmsg = NULL;
+
+	/* 1st pass: compute the breakpoints (in bytes). */
+	SEXP ans_breakpoints = PROTECT(NEW_INTEGER(ncigars));
+	long long nbytes = 0;
+	for (R_xlen_t i = 0; i < ncigars; i++) {
+		SEXP cigars_elt = STRING_ELT(cigars, i);
+		if (cigars_elt != NA_STRING) {
+			int nwords = count_words(CHAR(cigars_elt), &errmsg);
+			if (nwords == -1) {
+				UNPROTECT(1);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			nbytes += 4 * (long long) nwords;
+		}
+		if (nbytes > INT_MAX) {
+			UNPROTECT(1);
+			_too_many_elements_error("the returned raw data");
+		}
+		INTEGER(ans_breakpoints)[i] = (int) nbytes;
+	}
+
+	/* 2nd pass: write the words. */
+	SEXP unlisted_ans = PROTECT(NEW_RAW((R_xlen_t) nbytes));
+	unsigned char *out = RAW(unlisted_ans);
+	for (R_xlen_t i = 0; i < ncigars; i++) {
+		SEXP cigars_elt = STRING_ELT(cigars, i);
+		if (cigars_elt != NA_STRING)
+			out = write_words(CHAR(cigars_elt), out);
+	}
+
+	SEXP ans_partitioning =
+		PROTECT(new_PartitioningByEnd("PartitioningByEnd",
+					      ans_breakpoints, NULL));
+	SEXP ans = PROTECT(new_CompressedList("CompressedRawList",
+					      unlisted_ans, ans_partitioning));
+	UNPROTECT(4);
+	return ans;
+}
+
+
+/****************************************************************************
+ * C_decode_bam_cigars()
+ */
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   x: CompressedRawList object containing BAM-encoded CIGARs.
+ * Returns a character vector of the same length as 'x' containing the
+ * CIGAR strings. Zero-length list elements produce NAs.
+ */
+SEXP C_decode_bam_cigars(SEXP x)
+{
+	CigarsHolder x_holder = _new_CigarsHolder(x);
+	R_xlen_t ncigars = x_holder.length;
+	CharAE *cigar_buf = new_CharAE(0);
+	SEXP ans = PROTECT(NEW_CHARACTER(ncigars));
+	Cigar cigar;
+	for (R_xlen_t i = 0; i < ncigars; i++) {
+		_get_cigar(&x_holder, i, &cigar);
+		if (_cigar_is_star(&cigar)) {
+			SET_STRING_ELT(ans, i, NA_STRING);
+			continue;
+		}
+		CharAE_set_nelt(cigar_buf, 0);
+		int offset = 0, n, OPL;
+		char OP;
+		while ((n = _next_OP(&cigar, offset, &OP, &OPL))) {
+			if (n == -1) {
+				UNPROTECT(1);
+				error("in 'x[[%lld]]': %s", (long long) i + 1,
+				      _get_cigar_parsing_error());
+			}
+			_append_cigar_OP(cigar_buf, OP, OPL);
+			offset += n;
+		}
+		SEXP ans_elt = PROTECT(mkCharLen(cigar_buf->elts,
+					CharAE_get_nelt(cigar_buf)));
+		SET_STRING_ELT(ans, i, ans_elt);
+		UNPROTECT(1);
+	}
+	UNPROTECT(1);
+	return ans;
+}
+
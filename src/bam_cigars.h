@@ -0,0 +1,42 @@
+#ifndef _BAM_CIGARS_H_
+#define _BAM_CIGARS_H_
+
+#include <Rdefines.h>
+
+#include "explode_cigars.h"
+
+/* Gives uniform access to the elements of a character vector of CIGAR
+   strings, of a CompressedRawList object of BAM-encoded CIGARs, or of a
+   CigarStore object (see src/cigar_store.c). */
+typedef struct cigars_holder_t {
+	SEXP strings;                /* R_NilValue for BAM-encoded CIGARs */
+	const unsigned char *bytes;
+	const int *ends;             /* in bytes (CompressedRawList) */
+	const long long *ends64;     /* in words (CigarStore) */
+	long long nwords;            /* CigarStore only */
+	const int *ref_extents;      /* CigarStore only */
+	const int *query_extents;    /* CigarStore only */
+	R_xlen_t length;
+} CigarsHolder;
+
+CigarsHolder _new_CigarsHolder(SEXP cigars);
+
+int _get_cigar(
+	const CigarsHolder *x,
+	R_xlen_t i,
+	Cigar *cigar
+);
+
+int _cigar_is_star(const Cigar *cigar);
+
+const int *_get_precomputed_extents(
+	const CigarsHolder *x,
+	int space
+);
+
+SEXP C_encode_bam_cigars(SEXP cigars);
+
+SEXP C_decode_bam_cigars(SEXP x);
+
+#endif  /* _BAM_CIGARS_H_ */
+
@@ -0,0 +1,96 @@
+#include "cigar_chunks.h"
+
+#include <limits.h>  /* for INT_MAX */
+
+
+/* Rough number of bytes needed to store the output produced for a single
+   CIGAR operation by the functions that return one element per operation
+   (e.g. cigars_as_ranges() with 'with.ops' and 'with.oplens' set to TRUE):
+   a start, a width, and an oplen (3 ints), plus the op letter. */
+#define BYTES_PER_OP (3 * sizeof(int) + sizeof(char))
+
+/* Counts the letters in 'cig0'. This is a quick upper bound of the number
+   of operations in the CIGAR string that doesn't require parsing it. */
+static int count_cigar_ops(const char *cig0)
+{
+	int nops = 0;
+	for (const char *c = cig0; *c != '\0'; c++)
+		if (*c < '0' || *c > '9')
+			nops++;
+	return nops;
+}
+
+
+/* Walks on 'cigars' and stores the (1-based) end of each chunk in 'ans'
+   if 'ans' is not R_NilValue. Returns the number of chunks. */
+static R_xlen_t plan_chunks(SEXP cigars, int max_nelt, double max_bytes,
+		SEXP ans)
+{
+	R_xlen_t ncigars = XLENGTH(cigars), nchunk = 0;
+	int check_nelt = max_nelt != NA_INTEGER;
+	int check_bytes = !ISNAN(max_bytes);
+	R_xlen_t chunk_nelt = 0;
+	double chunk_bytes = 0.0;
+	for (R_xlen_t i = 0; i <= ncigars; i++) {
+		double bytes = 0.0;
+		if (i < ncigars && check_bytes) {
+			SEXP cigar_string = STRING_ELT(cigars, i);
+			if (cigar_string != NA_STRING)
+				bytes = LENGTH(cigar_string) +
+					(double) BYTES_PER_OP *
+					count_cigar_ops(CHAR(cigar_string));
+		}
+		if (chunk_nelt != 0 &&
+		    (i == ncigars ||
+		     (check_nelt && chunk_nelt >= max_nelt) ||
+		     (check_bytes && chunk_bytes + bytes > max_bytes)))
+		{
+			/* Close the current chunk. */
+			if (ans != R_NilValue) {
+				if (TYPEOF(ans) == INTSXP)
+					INTEGER(ans)[nchunk] = (int) i;
+				else
+					REAL(ans)[nchunk] = (double) i;
+			}
+			nchunk++;
+			chunk_nelt = 0;
+			chunk_bytes = 0.0;
+		}
+		chunk_nelt++;
+		chunk_bytes += bytes;
+	}
+	return nchunk;
+}
+
+
+/****************************************************************************
+ * C_plan_cigar_chunks()
+ */
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   cigars:      character vector containing CIGAR strings.
+ *   chunk_size:  a single integer (or NA) giving the maximum number of
+ *                CIGAR strings per chunk.
+ *   chunk_bytes: a single double (or NA) giving the maximum number of bytes
+ *                that the CIGAR strings in a chunk, and the output produced
+ *                for them, are expected to occupy (see BYTES_PER_OP above).
+ * A chunk is closed as soon as adding the next CIGAR string would exceed one
+ * of the 2 limits. Note that a chunk always contains at least one CIGAR
+ * string, even if that CIGAR string alone exceeds 'chunk_bytes'.
+ * Returns the vector of chunk ends (1-based). This is an integer vector,
+ * or a double vector if 'cigars' is a long vector.
+ */
+SEXP C_plan_cigar_chunks(SEXP cigars, SEXP chunk_size, SEXP chunk_bytes)
+{
+	int max_nelt = INTEGER(chunk_size)[0];
+	double max_bytes = REAL(chunk_bytes)[0];
+	R_xlen_t nchunk = plan_chunks(cigars, max_nelt, max_bytes,
+				      R_NilValue);
+	SEXP ans = PROTECT(XLENGTH(cigars) > INT_MAX ? NEW_NUMERIC(nchunk) :
+						       NEW_INTEGER(nchunk));
+	plan_chunks(cigars, max_nelt, max_bytes, ans);
+	UNPROTECT(1);
+	return ans;
+}
+
@@ -0,0 +1,12 @@
+#ifndef _CIGAR_CHUNKS_H_
+#define _CIGAR_CHUNKS_H_
+
+#include <Rdefines.h>
+
+SEXP C_plan_cigar_chunks(
+	SEXP cigars,
+	SEXP chunk_size,
+	SEXP chunk_bytes
+);
+
+#endif  /* _CIGAR_CHUNKS_H_ */
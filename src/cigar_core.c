@@ -0,0 +1,716 @@
+/****************************************************************************
+ *                     The R-independent core of cigarillo                  *
+ *                                                                          *
+ * The functions in this file parse CIGARs and compute extents, ranges,     *
+ * projections, and trimming bounds. They don't use the R API (no SEXP, no  *
+ * error(), no R_alloc()) so the file can also be compiled without R, e.g.  *
+ * by the native benchmark driver in inst/benchmarks/native/. Errors are    *
+ * reported by returning a pointer to a message held in a static buffer.    *
+ * The .Call entry points in the other files are thin wrappers around them. *
+ ****************************************************************************/
+#include "cigar_core.h"
+
+#include <stdio.h>   /* for snprintf() */
+#include <string.h>  /* for strchr() */
+#include <ctype.h>   /* for isdigit() */
+#include <limits.h>  /* for INT_MAX */
+
+
+/****************************************************************************
+ * Instrumentation counters
+ */
+
+int _stats_enabled = 0;
+
+long long _stats_counters[STATS_NCOUNTERS];
+
+
+/****************************************************************************
+ * Error reporting
+ */
+
+static char errmsg_buf[200];
+
+const char *_get_cigar_parsing_error()
+{
+	return errmsg_buf;
+}
+
+static char unknown_op_errmsg_buf[200];
+
+const char *_unknown_cigar_op_error(char OP, int op_idx)
+{
+	snprintf(unknown_op_errmsg_buf, sizeof(unknown_op_errmsg_buf),
+		 "unknown CIGAR operation '%c' (operation %d)",
+		 OP, op_idx + 1);
+	return unknown_op_errmsg_buf;
+}
+
+const char *_get_unknown_cigar_op_error()
+{
+	return unknown_op_errmsg_buf;
+}
+
+/* Constant strings so the callers (and _errmsg_as_errcode()) can recognize
+   these errors. */
+static const char *empty_cigar_msg = "CIGAR string is empty";
+static const char *empty_after_trimming_msg = "CIGAR is empty after trimming";
+static const char *empty_after_softclipping_msg =
+	"no aligned position left after soft-clipping";
+
+const char *_empty_cigar_error()
+{
+	return empty_cigar_msg;
+}
+
+const char *_empty_after_trimming_error()
+{
+	return empty_after_trimming_msg;
+}
+
+const char *_empty_after_softclipping_error()
+{
+	return empty_after_softclipping_msg;
+}
+
+
+/****************************************************************************
+ * _next_cigar_OP() and _prev_cigar_OP()
+ */
+
+static int oplen_too_big(int offset)
+{
+	snprintf(errmsg_buf, sizeof(errmsg_buf),
+		 "CIGAR operation length at char %d is greater than %d",
+		 offset + 1, INT_MAX);
+	return -1;
+}
+
+/* Return the number of chars that was read, or 0 if there is no more char
+   to read (i.e. cigar_string[offset] is '\0'), or -1 in case of a parse error
+   (in which case _get_cigar_parsing_error() can be used to get a pointer to
+   the error message).
+   Zero-length operations are ignored. Operation lengths that don't fit in
+   an int are reported as a parse error. */
+int _next_cigar_OP(const char *cigar_string, int offset, char *OP, int *OPL)
+{
+	char c;
+	int offset0;
+	long long opl;
+
+	if (!cigar_string[offset])
+		return 0;
+	offset0 = offset;
+	do {
+		/* Extract *OPL */
+		opl = 0;
+		while (isdigit(c = cigar_string[offset])) {
+			opl *= 10;
+			opl += c - '0';
+			if (opl > INT_MAX)
+				return oplen_too_big(offset);
+			offset++;
+		}
+		/* Extract *OP */
+		if (!(*OP = cigar_string[offset])) {
+			snprintf(errmsg_buf, sizeof(errmsg_buf),
+				 "unexpected CIGAR end after char %d",
+				 offset);
+			return -1;
+		}
+		offset++;
+	} while (opl == 0);
+	*OPL = (int) opl;
+	STATS_COUNT_OP(offset - offset0);
+	return offset - offset0;
+}
+
+/* Return the number of chars that was read, or 0 if there is no more char
+   to read (i.e. offset is 0), or -1 in case of a parse error.
+   Zero-length operations are ignored. */
+int _prev_cigar_OP(const char *cigar_string, int offset, char *OP, int *OPL)
+{
+	char c;
+	int offset0;
+	long long opl, powof10;
+
+	if (offset == 0)
+		return 0;
+	offset0 = offset;
+	do {
+		/* Extract *OP */
+		offset--;
+		*OP = cigar_string[offset];
+		/* Extract *OPL */
+		if (offset == 0) {
+			snprintf(errmsg_buf, sizeof(errmsg_buf),
+				 "no CIGAR operation length before char %d",
+				 offset + 1);
+			return -1;
+		}
+		offset--;
+		opl = 0;
+		powof10 = 1;
+		while (offset >= 0 && isdigit(c = cigar_string[offset])) {
+			opl += (c - '0') * powof10;
+			if (opl > INT_MAX)
+				return oplen_too_big(offset);
+			/* Leading zeros are allowed so we only need to stop
+			   growing 'powof10' once it's too big. */
+			if (powof10 <= INT_MAX)
+				powof10 *= 10;
+			offset--;
+		}
+		offset++;
+	} while (opl == 0);
+	*OPL = (int) opl;
+	STATS_COUNT_OP(offset0 - offset);
+	return offset0 - offset;
+}
+
+
+/****************************************************************************
+ * _next_OP()
+ */
+
+/* Like _next_cigar_OP() but works on a Cigar struct. For a BAM-encoded
+   CIGAR, 'offset' is the index of the next word to read and the returned
+   value is the number of words that was read. */
+int _next_OP(const Cigar *cigar, int offset, char *OP, int *OPL)
+{
+	static const char bamOPs[] = "MIDNSHP=X";
+	unsigned int word, OPcode;
+	int offset0;
+
+	if (cigar->string != NULL)
+		return _next_cigar_OP(cigar->string, offset, OP, OPL);
+	offset0 = offset;
+	do {
+		if (offset >= cigar->nwords)
+			return 0;
+		const unsigned char *p = cigar->words + 4 * (size_t) offset;
+		word = (unsigned int) p[0] | (unsigned int) p[1] << 8 |
+		       (unsigned int) p[2] << 16 | (unsigned int) p[3] << 24;
+		offset++;
+	} while ((word >> 4) == 0);
+	OPcode = word & 0xf;
+	if (OPcode >= 9) {
+		snprintf(errmsg_buf, sizeof(errmsg_buf),
+			 "invalid CIGAR operation code %u in word %d",
+			 OPcode, offset);
+		return -1;
+	}
+	*OP = bamOPs[OPcode];
+	*OPL = (int) (word >> 4);
+	STATS_COUNT_OP(4 * (offset - offset0));
+	return offset - offset0;
+}
+
+
+/****************************************************************************
+ * _split_cigar()
+ */
+
+/* Same as _tokenize_cigar() but writes to buffers of fixed length provided
+   by the caller. At most 'buflen' operations are written but '*nops' is set
+   to the total number of operations. Part of the C interface (see
+   inst/include/cigarillo_interface.h). */
+const char *_split_cigar(const char *cigar_string,
+		char *OPs, int *OPLs, int buflen, int *nops)
+{
+	int offset, n, i, OPL /* Operation Length */;
+	char OP /* Operation */;
+
+	offset = i = 0;
+	while ((n = _next_cigar_OP(cigar_string, offset, &OP, &OPL))) {
+		if (n == -1)
+			return _get_cigar_parsing_error();
+		if (i < buflen) {
+			OPs[i] = OP;
+			OPLs[i] = OPL;
+		}
+		i++;
+		offset += n;
+	}
+	*nops = i;
+	return NULL;
+}
+
+
+/****************************************************************************
+ * _op_is_visible()
+ */
+
+int _op_is_visible(char OP, int space)
+{
+	if (OP == 'M')
+		return 1;
+	switch (space) {
+	    case QUERY_BEFORE_HARD_CLIPPING:
+		if (OP == 'H')
+			return 1;
+		/* fall through */
+	    case QUERY:
+		if (OP == 'S')
+			return 1;
+		/* fall through */
+	    case QUERY_AFTER_SOFT_CLIPPING:
+		if (OP == 'I')
+			return 1;
+		break;
+	    case PAIRWISE:
+		if (OP == 'I')
+			return 1;
+		/* fall through */
+	    case REFERENCE:
+		if (OP == 'D' || OP == 'N')
+			return 1;
+		break;
+	    case PAIRWISE_N_REGIONS_REMOVED:
+		if (OP == 'I')
+			return 1;
+		/* fall through */
+	    case REFERENCE_N_REGIONS_REMOVED:
+		if (OP == 'D')
+			return 1;
+	}
+	if (OP == '=' || OP == 'X')
+		return 1;
+	return 0;
+}
+
+
+/****************************************************************************
+ * Extents
+ */
+
+/* Extent of the CIGAR operations previously extracted by _tokenize_cigar()
+   along the specified projection space. Like with _compute_cigar_extent(),
+   the extent is a long long so it cannot overflow. The callers that need
+   an int must check that it fits. */
+long long _tokens_extent(const char *OPs, const int *OPLs, int nops,
+			 int space)
+{
+	long long x = 0;
+	for (int i = 0; i < nops; i++) {
+		if (_op_is_visible(OPs[i], space))
+			x += OPLs[i];
+	}
+	return x;
+}
+
+/* The extent is accumulated in a long long so it cannot overflow (a
+   CIGAR string would need more than 2^32 operations for that). */
+const char *_compute_cigar_extent(const Cigar *cigar, int space,
+				  long long *extent)
+{
+	int cigar_offset, n, OPL /* Operation Length */;
+	char OP /* Operation */;
+	long long x;
+
+	x = cigar_offset = 0;
+	while ((n = _next_OP(cigar, cigar_offset, &OP, &OPL))) {
+		if (n == -1)
+			return _get_cigar_parsing_error();
+		if (_op_is_visible(OP, space))
+			x += OPL;
+		cigar_offset += n;
+	}
+	*extent = x;
+	return NULL;
+}
+
+/* Part of the C interface (see inst/include/cigarillo_interface.h). */
+const char *_cigar_extent(const char *cigar_string, int space,
+			  long long *extent)
+{
+	Cigar cigar = { cigar_string, NULL, 0 };
+	return _compute_cigar_extent(&cigar, space, extent);
+}
+
+
+/****************************************************************************
+ * Projections
+ */
+
+/*
+ * _to_ref() and _to_query() originally written by Michael Lawrence in 2012
+ * for the GenomicRanges package.
+ * Code moved from GenomicRanges to GenomicAlignments on Dec 6, 2013.
+ * Code copied from GenomicAlignments to cigarillo on Sep 12, 2025.
+ * Code moved from src/project_positions.c to src/cigar_core.c.
+ */
+
+/* Turns single position along query space ('query_pos') into position
+   along reference space.
+   If 'query_pos' cannot be mapped (or 'cig' cannot be parsed) NA is
+   returned. */
+int _to_ref(int query_pos, const Cigar *cig, int lmmpos, int narrow_left)
+{
+  int ref_pos = query_pos + lmmpos - 1;
+  int n = 0, offset = 0, OPL, query_consumed = 0;
+  char OP;
+
+  while (query_consumed < query_pos &&
+         (n = _next_OP(cig, offset, &OP, &OPL)) > 0)
+  {
+    switch (OP) {
+      /* Alignment match (can be a sequence match or mismatch) */
+      case 'M': case '=': case 'X':
+          query_consumed += OPL;
+          break;
+      /* Insertion to the reference */
+      case 'I': {
+        int width_from_insertion_start = query_pos - query_consumed;
+        int query_pos_past_insertion = width_from_insertion_start > OPL;
+        if (query_pos_past_insertion) {
+          ref_pos -= OPL;
+        } else {
+          ref_pos -= width_from_insertion_start;
+          if (!narrow_left) {
+            ref_pos += 1;
+          }
+        }
+        query_consumed += OPL;
+        break;
+      }
+      /* Soft clip on the read */
+      case 'S':
+        query_consumed += OPL;
+        break;
+      /* Deletion from the reference */
+      case 'D':
+      case 'N': /* Skipped region from reference; narrow to query */
+        ref_pos += OPL;
+        break;
+      /* Hard clip on the read */
+      case 'H':
+        break;
+      /* Silent deletion from the padded reference */
+      case 'P':
+        break;
+      default:
+        break;
+    }
+    offset += n;
+  }
+
+  if (n <= 0)
+    ref_pos = CORE_NA_INTEGER;
+
+  return ref_pos;
+}
+
+/* Turns single position along reference space ('ref_pos') into position
+   along query space.
+   If 'ref_pos' cannot be mapped (or 'cig' cannot be parsed) NA is
+   returned. */
+int _to_query(int ref_pos, const Cigar *cig, int lmmpos, int narrow_left)
+{
+  int query_pos = ref_pos - lmmpos + 1;
+  int n = 0, offset = 0, OPL, query_consumed = 0;
+  char OP;
+
+  while (query_consumed < query_pos &&
+         (n = _next_OP(cig, offset, &OP, &OPL)) > 0)
+  {
+    switch (OP) {
+    /* Alignment match (can be a sequence match or mismatch) */
+    case 'M': case '=': case 'X':
+      query_consumed += OPL;
+      break;
+    /* Insertion to the reference */
+    case 'I':
+    /* Soft clip on the read */
+    case 'S':
+      query_pos += OPL;
+      query_consumed += OPL;
+      break;
+    /* Deletion from the reference */
+    case 'D':
+    /* Skipped region from reference; narrow to query */
+    case 'N':
+      {
+        int query_pos_past_gap = query_pos - query_consumed > OPL;
+        if (query_pos_past_gap) {
+          query_pos -= OPL;
+        } else {
+          if (narrow_left) {
+            query_pos = query_consumed;
+          } else {
+            query_pos = query_consumed + 1;
+          }
+        }
+      }
+      break;
+    /* Hard clip on the read */
+    case 'H':
+      break;
+    /* Silent deletion from the padded reference */
+    case 'P':
+      break;
+    default:
+      break;
+    }
+    offset += n;
+  }
+
+  if (query_pos <= 0 || n <= 0)
+    query_pos = CORE_NA_INTEGER;
+
+  return query_pos;
+}
+
+/* _to_ref() and _to_query() on a CIGAR string. Part of the C interface
+   (see inst/include/cigarillo_interface.h). */
+int _query_pos_as_ref_pos(int query_pos, const char *cigar_string,
+                          int lmmpos, int narrow_left)
+{
+  Cigar cig = { cigar_string, NULL, 0 };
+  return _to_ref(query_pos, &cig, lmmpos, narrow_left);
+}
+
+int _ref_pos_as_query_pos(int ref_pos, const char *cigar_string,
+                          int lmmpos, int narrow_left)
+{
+  Cigar cig = { cigar_string, NULL, 0 };
+  return _to_query(ref_pos, &cig, lmmpos, narrow_left);
+}
+
+
+/****************************************************************************
+ * _cigar_ranges()
+ */
+
+/* Same as parse_cigar_ranges() in src/cigars_as_ranges.c (without the ops
+   and oplens) but works on a CIGAR string and writes the ranges to buffers
+   of fixed length provided by the caller. At most 'buflen' ranges are
+   written but '*nranges' is set to the total number of ranges. 'ops' is a
+   nul-terminated string of CIGAR operation letters, or NULL to keep all
+   the operations. Doesn't use the lookup table set by
+   _init_ops_lkup_table() so is safe to call from anywhere. Part of the C
+   interface (see inst/include/cigarillo_interface.h).
+ */
+const char *_cigar_ranges(const char *cigar_string,
+		int space, int lmmpos, const char *ops,
+		int drop_empty_ranges, int reduce_ranges,
+		int *starts, int *widths, int buflen, int *nranges)
+{
+	int cigar_offset = 0, nelt = 0;
+	int start = lmmpos, prev_end_plus_1 = 0;
+	int n, OPL /* Operation Length */;
+	char OP /* Operation */;
+	while ((n = _next_cigar_OP(cigar_string, cigar_offset, &OP, &OPL))) {
+		if (n == -1)
+			return _get_cigar_parsing_error();
+		int width = _op_is_visible(OP, space) ? OPL : 0;
+		cigar_offset += n;
+		if ((ops != NULL && strchr(ops, (int) OP) == NULL) ||
+		    (drop_empty_ranges && width == 0))
+		{
+			start += width;
+			continue;
+		}
+		if (reduce_ranges && nelt > 0 && start == prev_end_plus_1) {
+			/* Merge. */
+			if (nelt <= buflen)
+				widths[nelt - 1] += width;
+		} else {
+			/* Append. */
+			if (nelt < buflen) {
+				starts[nelt] = start;
+				widths[nelt] = width;
+			}
+			nelt++;
+		}
+		start += width;
+		prev_end_plus_1 = start;
+	}
+	*nranges = nelt;
+	return NULL;
+}
+
+
+/****************************************************************************
+ * Ltrim_along_ref() and Rtrim_along_ref()
+ *
+ * All the Ltrim_*() and Rtrim_*() functions below walk on the CIGAR
+ * operations previously extracted by _tokenize_cigar() or _split_cigar().
+ * The CIGAR string itself is never looked at again. They set '*Lidx' (or
+ * '*Ridx') to the index of the first (or last) operation to keep, and
+ * '*Lnpos' (or '*Rnpos') to the number of positions that remain to be
+ * trimmed from that operation.
+ */
+
+static const char *Ltrim_along_ref(const char *OPs, const int *OPLs, int nops,
+				   int *Lnpos, int *Lidx, int *rshift)
+{
+	*rshift = 0;
+	for (int i = 0; i < nops; i++) {
+		char OP = OPs[i];
+		int OPL = OPLs[i];
+		switch (OP) {
+		/* Alignment match (can be a sequence match or mismatch) */
+		    case 'M': case '=': case 'X':
+			if (*Lnpos < OPL) {
+				*Lidx = i;
+				*rshift += *Lnpos;
+				return NULL;
+			}
+			*Lnpos -= OPL;
+			*rshift += OPL;
+		    break;
+		/* Insertion to the reference or soft/hard clip on the read */
+		    case 'I': case 'S': case 'H':
+		    break;
+		/* Deletion (or skipped region) from the reference */
+		    case 'D': case 'N':
+			if (*Lnpos < OPL)
+				*Lnpos = 0;
+			else
+				*Lnpos -= OPL;
+			*rshift += OPL;
+		    break;
+		/* Silent deletion from the padded reference */
+		    case 'P': break;
+		    default: return _unknown_cigar_op_error(OP, i);
+		}
+	}
+	return empty_after_trimming_msg;
+}
+
+static const char *Rtrim_along_ref(const char *OPs, const int *OPLs, int nops,
+				   int *Rnpos, int *Ridx)
+{
+	for (int i = nops - 1; i >= 0; i--) {
+		char OP = OPs[i];
+		int OPL = OPLs[i];
+		switch (OP) {
+		/* Alignment match (can be a sequence match or mismatch) */
+		    case 'M': case '=': case 'X':
+			if (*Rnpos < OPL) {
+				*Ridx = i;
+				return NULL;
+			}
+			*Rnpos -= OPL;
+		    break;
+		/* Insertion to the reference or soft/hard clip on the read */
+		    case 'I': case 'S': case 'H':
+		    break;
+		/* Deletion (or skipped region) from the reference */
+		    case 'D': case 'N':
+			if (*Rnpos < OPL)
+				*Rnpos = 0;
+			else
+				*Rnpos -= OPL;
+		    break;
+		/* Silent deletion from the padded reference */
+		    case 'P': break;
+		    default: return _unknown_cigar_op_error(OP, i);
+		}
+	}
+	return empty_after_trimming_msg;
+}
+
+
+/****************************************************************************
+ * Ltrim_along_query() and Rtrim_along_query()
+ */
+
+static const char *Ltrim_along_query(const char *OPs, const int *OPLs,
+				     int nops,
+				     int *Lnpos, int *Lidx, int *rshift)
+{
+	*rshift = 0;
+	for (int i = 0; i < nops; i++) {
+		char OP = OPs[i];
+		int OPL = OPLs[i];
+		switch (OP) {
+		/* Alignment match (can be a sequence match or mismatch) */
+		    case 'M': case '=': case 'X':
+			if (*Lnpos < OPL) {
+				*Lidx = i;
+				*rshift += *Lnpos;
+				return NULL;
+			}
+			*Lnpos -= OPL;
+			*rshift += OPL;
+		    break;
+		/* Insertion to the reference or soft/hard clip on the read */
+		    case 'I': case 'S': case 'H':
+			if (*Lnpos < OPL) {
+				*Lidx = i;
+				return NULL;
+			}
+			*Lnpos -= OPL;
+		    break;
+		/* Deletion (or skipped region) from the reference */
+		    case 'D': case 'N':
+			*rshift += OPL;
+		    break;
+		/* Silent deletion from the padded reference */
+		    case 'P': break;
+		    default: return _unknown_cigar_op_error(OP, i);
+		}
+	}
+	return empty_after_trimming_msg;
+}
+
+static const char *Rtrim_along_query(const char *OPs, const int *OPLs,
+				     int nops,
+				     int *Rnpos, int *Ridx)
+{
+	for (int i = nops - 1; i >= 0; i--) {
+		char OP = OPs[i];
+		int OPL = OPLs[i];
+		switch (OP) {
+		/* M, =, X, I, S, H */
+		    case 'M': case '=': case 'X': case 'I': case 'S': case 'H':
+			if (*Rnpos < OPL) {
+				*Ridx = i;
+				return NULL;
+			}
+			*Rnpos -= OPL;
+		    break;
+		/* Deletion (or skipped region) from the reference,
+		   or silent deletion from the padded reference */
+		    case 'D': case 'N': case 'P':
+		    break;
+		    default: return _unknown_cigar_op_error(OP, i);
+		}
+	}
+	return empty_after_trimming_msg;
+}
+
+
+/****************************************************************************
+ * _get_trim_bounds()
+ */
+
+/* Find the first and last operations to keep ('*Lidx' and '*Ridx') and the
+   number of positions that remain to be trimmed from them ('*Lnpos' and
+   '*Rnpos'). */
+const char *_get_trim_bounds(const char *OPs, const int *OPLs, int nops,
+		int along_query, int *Lnpos, int *Lidx, int *Rnpos, int *Ridx,
+		int *rshift)
+{
+	const char *errmsg;
+	if (along_query) {
+		errmsg = Ltrim_along_query(OPs, OPLs, nops,
+					   Lnpos, Lidx, rshift);
+		if (errmsg != NULL)
+			return errmsg;
+		errmsg = Rtrim_along_query(OPs, OPLs, nops, Rnpos, Ridx);
+	} else {
+		errmsg = Ltrim_along_ref(OPs, OPLs, nops,
+					 Lnpos, Lidx, rshift);
+		if (errmsg != NULL)
+			return errmsg;
+		errmsg = Rtrim_along_ref(OPs, OPLs, nops, Rnpos, Ridx);
+	}
+	if (errmsg != NULL)
+		return errmsg;
+	if (*Ridx < *Lidx)
+		return empty_after_trimming_msg;
+	return NULL;
+}
@@ -0,0 +1,197 @@
+#ifndef _CIGAR_CORE_H_
+#define _CIGAR_CORE_H_
+
+/* This header (and cigar_core.c) must not include any R header. */
+
+#include <limits.h>  /* for INT_MIN */
+
+/* The 8 "projection spaces" below are also defined at the top of the
+   R/project_sequences.R file and in inst/include/cigarillo_defines.h. */
+#define REFERENCE                       1
+#define REFERENCE_N_REGIONS_REMOVED     2
+#define QUERY                           3
+#define QUERY_BEFORE_HARD_CLIPPING      4
+#define QUERY_AFTER_SOFT_CLIPPING       5
+#define PAIRWISE                        6
+#define PAIRWISE_N_REGIONS_REMOVED      7
+#define PAIRWISE_DENSE                  8
+
+/* Same value as NA_INTEGER in R. */
+#define CORE_NA_INTEGER INT_MIN
+
+/* Instrumentation counters (see src/cigarillo_stats.c). They are only
+   updated when '_stats_enabled' is set, with atomic operations so they
+   stay correct if the kernels are run from several threads. */
+#define STATS_OPS             0  /* CIGAR operations tokenized */
+#define STATS_BYTES_SCANNED   1  /* bytes of CIGAR data read */
+#define STATS_BUF_GROWTHS     2  /* growths of the AE buffers */
+#define STATS_NCOUNTERS       3
+
+extern int _stats_enabled;
+extern long long _stats_counters[STATS_NCOUNTERS];
+
+#if defined(__GNUC__) || defined(__clang__)
+#define STATS_ATOMIC_ADD(p, n) __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+#define STATS_ATOMIC_LOAD(p)   __atomic_load_n((p), __ATOMIC_RELAXED)
+#else
+#define STATS_ATOMIC_ADD(p, n) (*(p) += (n))
+#define STATS_ATOMIC_LOAD(p)   (*(p))
+#endif
+
+#define STATS_ADD(counter, n) \
+	do { \
+		if (_stats_enabled) \
+			STATS_ATOMIC_ADD(&_stats_counters[counter], \
+					 (long long) (n)); \
+	} while (0)
+
+/* Count 1 growth of an AE buffer if its 'elts' field changed from 'elts0'
+   during an insertion. The AE buffers used by the .Call entry points are
+   allocated with R_alloc() so growing one always moves its elements. This
+   way we don't need to look at the private '_buflength' field of the AE. */
+#define STATS_COUNT_GROWTH(elts0, elts) \
+	do { \
+		if ((const void *) (elts) != (const void *) (elts0)) \
+			STATS_ADD(STATS_BUF_GROWTHS, 1); \
+	} while (0)
+
+/* Count 1 tokenized operation that was read from 'nbytes' bytes. */
+#define STATS_COUNT_OP(nbytes) \
+	do { \
+		if (_stats_enabled) { \
+			STATS_ATOMIC_ADD(&_stats_counters[STATS_OPS], 1LL); \
+			STATS_ATOMIC_ADD(&_stats_counters[STATS_BYTES_SCANNED], \
+					 (long long) (nbytes)); \
+		} \
+	} while (0)
+
+/* A CIGAR is either a CIGAR string or a BAM-encoded CIGAR i.e. an array
+   of little-endian uint32 words (see src/bam_cigars.c). */
+typedef struct cigar_t {
+	const char *string;          /* NULL for a BAM-encoded CIGAR */
+	const unsigned char *words;
+	int nwords;
+} Cigar;
+
+const char *_get_cigar_parsing_error();
+
+const char *_unknown_cigar_op_error(
+	char OP,
+	int op_idx
+);
+
+const char *_get_unknown_cigar_op_error();
+
+const char *_empty_cigar_error();
+
+const char *_empty_after_trimming_error();
+
+const char *_empty_after_softclipping_error();
+
+int _next_cigar_OP(
+	const char *cigar_string,
+	int offset,
+	char *OP,
+	int *OPL
+);
+
+int _prev_cigar_OP(
+	const char *cigar_string,
+	int offset,
+	char *OP,
+	int *OPL
+);
+
+int _next_OP(
+	const Cigar *cigar,
+	int offset,
+	char *OP,
+	int *OPL
+);
+
+const char *_split_cigar(
+	const char *cigar_string,
+	char *OPs,
+	int *OPLs,
+	int buflen,
+	int *nops
+);
+
+int _op_is_visible(
+	char OP,
+	int space
+);
+
+long long _tokens_extent(
+	const char *OPs,
+	const int *OPLs,
+	int nops,
+	int space
+);
+
+const char *_compute_cigar_extent(
+	const Cigar *cigar,
+	int space,
+	long long *extent
+);
+
+const char *_cigar_extent(
+	const char *cigar_string,
+	int space,
+	long long *extent
+);
+
+int _to_ref(
+	int query_pos,
+	const Cigar *cig,
+	int lmmpos,
+	int narrow_left
+);
+
+int _to_query(
+	int ref_pos,
+	const Cigar *cig,
+	int lmmpos,
+	int narrow_left
+);
+
+int _query_pos_as_ref_pos(
+	int query_pos,
+	const char *cigar_string,
+	int lmmpos,
+	int narrow_left
+);
+
+int _ref_pos_as_query_pos(
+	int ref_pos,
+	const char *cigar_string,
+	int lmmpos,
+	int narrow_left
+);
+
+const char *_cigar_ranges(
+	const char *cigar_string,
+	int space,
+	int lmmpos,
+	const char *ops,
+	int drop_empty_ranges,
+	int reduce_ranges,
+	int *starts,
+	int *widths,
+	int buflen,
+	int *nranges
+);
+
+const char *_get_trim_bounds(
+	const char *OPs,
+	const int *OPLs,
+	int nops,
+	int along_query,
+	int *Lnpos,
+	int *Lidx,
+	int *Rnpos,
+	int *Ridx,
+	int *rshift
+);
+
+#endif  /* _CIGAR_CORE_H_ */
@@ -0,0 +1,255 @@
+#include "cigar_density.h"
+
+#include "S4Vectors_interface.h"
+
+#include "explode_cigars.h"
+#include "bam_cigars.h"
+
+#include <string.h>  /* for memset() */
+#include <limits.h>  /* for INT_MAX */
+
+
+/****************************************************************************
+ * Adding events and bases to the bins
+ *
+ * 'events' and 'bases' point to the column of the current op in the
+ * event and base matrices, at the row of the first bin of the current
+ * sequence. Positions are 1-based. What falls outside of the sequence
+ * (i.e. outside of [1, seq_end]) is ignored.
+ */
+
+static void add_event(double *events, long long seq_end, int bin_width,
+		long long pos)
+{
+	if (pos < 1 || pos > seq_end)
+		return;
+	events[(pos - 1) / bin_width] += 1.0;
+	return;
+}
+
+static void add_bases(double *bases, long long seq_end, int bin_width,
+		long long start, long long width)
+{
+	long long end = start + width - 1;
+	if (start < 1)
+		start = 1;
+	if (end > seq_end)
+		end = seq_end;
+	while (start <= end) {
+		long long b = (start - 1) / bin_width;
+		long long bin_end = (b + 1) * bin_width;
+		if (bin_end > end)
+			bin_end = end;
+		bases[b] += (double) (bin_end - start + 1);
+		start = bin_end + 1;
+	}
+	return;
+}
+
+
+/****************************************************************************
+ * C_bin_cigar_ops_along_ref()
+ */
+
+/* Returns NULL on success, or an error message. The bins are only updated
+   if the CIGAR is valid. 'op_cols' maps each op letter to its column in
+   the event and base matrices (or -1 if the op is not selected). */
+static const char *bin_cigar_ops(const Cigar *cigar, int lmmpos,
+		const int *op_cols, CharAE *OP_buf, IntAE *OPL_buf,
+		double *events, double *bases, R_xlen_t nrow,
+		long long seq_end, int bin_width)
+{
+	int offset = 0, n, OPL;
+	char OP;
+
+	CharAE_set_nelt(OP_buf, 0);
+	IntAE_set_nelt(OPL_buf, 0);
+	while ((n = _next_OP(cigar, offset, &OP, &OPL))) {
+		if (n == -1)
+			return _get_cigar_parsing_error();
+		CharAE_insert_at(OP_buf, CharAE_get_nelt(OP_buf), OP);
+		IntAE_insert_at(OPL_buf, IntAE_get_nelt(OPL_buf), OPL);
+		offset += n;
+	}
+	int nops = IntAE_get_nelt(OPL_buf);
+	long long pos = lmmpos;  /* ref position of the next op */
+	int leading = 1;  /* are we still in the leading clips? */
+	for (int k = 0; k < nops; k++) {
+		OP = OP_buf->elts[k];
+		OPL = OPL_buf->elts[k];
+		int is_clip = OP == 'S' || OP == 'H';
+		int col = op_cols[(unsigned char) OP];
+		if (col != -1) {
+			R_xlen_t col_offset = (R_xlen_t) col * nrow;
+			if (is_clip) {
+				/* The breakpoint is reported at the aligned
+				   base next to the clip. */
+				add_event(events + col_offset, seq_end, bin_width,
+					  leading ? pos : pos - 1);
+			} else if (!_op_is_visible(OP, REFERENCE)) {
+				/* An insertion is reported at the base that
+				   precedes it. */
+				add_event(events + col_offset, seq_end, bin_width,
+					  pos - 1);
+			} else {
+				add_event(events + col_offset, seq_end, bin_width,
+					  pos);
+				add_bases(bases + col_offset, seq_end, bin_width,
+					  pos, OPL);
+			}
+		}
+		if (!is_clip)
+			leading = 0;
+		if (_op_is_visible(OP, REFERENCE))
+			pos += OPL;
+	}
+	return NULL;
+}
+
+/* Returns the position of the last base covered by the alignment, or 0 if
+   the CIGAR cannot be parsed. */
+static long long alignment_end(const Cigar *cigar, int lmmpos)
+{
+	long long extent;
+	if (_compute_cigar_extent(cigar, REFERENCE, &extent) != NULL)
+		return 0;
+	return lmmpos + extent - 1;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   cigars:      a character vector, or a CompressedRawList or CigarStore
+ *                object (see _new_CigarsHolder()).
+ *   lmmpos:      integer vector of the same length as 'cigars' (or of
+ *                length 1) containing the 1-based leftmost mapping
+ *                positions.
+ *   seqnames:    integer vector of the same length as 'cigars' (or of
+ *                length 1) containing the 1-based index of the sequence of
+ *                each alignment (typically the codes of a factor).
+ *   seqlengths:  integer vector with one element per sequence. An NA means
+ *                that the length of the sequence must be inferred from the
+ *                alignments (i.e. it's the end of the rightmost alignment
+ *                on the sequence).
+ *   bin_width:   a single positive integer.
+ *   ops:         a character vector of distinct single-letter CIGAR
+ *                operations.
+ *   na_on_error: TRUE or FALSE.
+ * The alignments with an NA (or 0) lmmpos or seqname, or an NA or "*"
+ * CIGAR, are ignored.
+ * Walks on each CIGAR along the reference space and counts, for each op in
+ * 'ops', the number of occurences of the op (events) and the number of
+ * reference positions that it covers (bases) in each bin. Nothing else than
+ * the bins is allocated.
+ * Returns a list of 3 elements:
+ *   1. An integer vector parallel to 'seqlengths' with the number of bins
+ *      of each sequence.
+ *   2. A double matrix with 1 row per bin (the bins of all the sequences
+ *      stacked) and 1 column per op, containing the event counts.
+ *   3. Same as 2. but containing the base counts.
+ */
+SEXP C_bin_cigar_ops_along_ref(SEXP cigars, SEXP lmmpos, SEXP seqnames,
+		SEXP seqlengths, SEXP bin_width, SEXP ops, SEXP na_on_error)
+{
+	CigarsHolder cigars_holder = _new_CigarsHolder(cigars);
+	R_xlen_t ncigars = cigars_holder.length;
+	R_xlen_t lmmpos_len = XLENGTH(lmmpos);
+	R_xlen_t seqnames_len = XLENGTH(seqnames);
+	const int *lmmpos_p = INTEGER(lmmpos);
+	const int *seqnames_p = INTEGER(seqnames);
+	int nseq = LENGTH(seqlengths);
+	int bin_width0 = INTEGER(bin_width)[0];
+	int nop = LENGTH(ops);
+	Cigar cigar;
+
+	int op_cols[256];
+	for (int c = 0; c < 256; c++)
+		op_cols[c] = -1;
+	for (int j = 0; j < nop; j++)
+		op_cols[(unsigned char) CHAR(STRING_ELT(ops, j))[0]] = j;
+
+	/* Infer the missing sequence lengths. */
+	long long *seq_ends = (long long *) R_alloc(nseq, sizeof(long long));
+	int infer = 0;
+	for (int s = 0; s < nseq; s++) {
+		int seqlength = INTEGER(seqlengths)[s];
+		seq_ends[s] = seqlength == NA_INTEGER ? 0 : seqlength;
+		if (seqlength == NA_INTEGER)
+			infer = 1;
+	}
+	for (R_xlen_t i = 0; infer && i < ncigars; i++) {
+		int s = seqnames_p[seqnames_len == 1 ? 0 : i];
+		int pos = lmmpos_p[lmmpos_len == 1 ? 0 : i];
+		if (s == NA_INTEGER || pos == NA_INTEGER || pos == 0 ||
+		    INTEGER(seqlengths)[s - 1] != NA_INTEGER)
+			continue;
+		if (!_get_cigar(&cigars_holder, i, &cigar) ||
+		    _cigar_is_star(&cigar))
+			continue;
+		long long end = alignment_end(&cigar, pos);
+		if (end > seq_ends[s - 1])
+			seq_ends[s - 1] = end;
+	}
+
+	/* Allocate the bins. */
+	SEXP ans_nbins = PROTECT(NEW_INTEGER(nseq));
+	R_xlen_t *first_bin = (R_xlen_t *) R_alloc(nseq, sizeof(R_xlen_t));
+	R_xlen_t nrow = 0;
+	for (int s = 0; s < nseq; s++) {
+		long long nbins = (seq_ends[s] + bin_width0 - 1) / bin_width0;
+		if (nbins > INT_MAX) {
+			UNPROTECT(1);
+			error("too many bins for sequence %d (use a bigger "
+			      "'bin.width')", s + 1);
+		}
+		INTEGER(ans_nbins)[s] = (int) nbins;
+		first_bin[s] = nrow;
+		nrow += nbins;
+	}
+	if (nrow > INT_MAX) {
+		UNPROTECT(1);
+		_too_many_elements_error("the returned matrices");
+	}
+	SEXP ans_events = PROTECT(allocMatrix(REALSXP, (int) nrow, nop));
+	SEXP ans_bases = PROTECT(allocMatrix(REALSXP, (int) nrow, nop));
+	memset(REAL(ans_events), 0, XLENGTH(ans_events) * sizeof(double));
+	memset(REAL(ans_bases), 0, XLENGTH(ans_bases) * sizeof(double));
+
+	/* Walk on the alignments. */
+	CharAE *OP_buf = new_CharAE(0);
+	IntAE *OPL_buf = new_IntAE(0, 0, 0);
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, ncigars));
+	for (R_xlen_t i = 0; i < ncigars; i++) {
+		int s = seqnames_p[seqnames_len == 1 ? 0 : i];
+		int pos = lmmpos_p[lmmpos_len == 1 ? 0 : i];
+		if (s == NA_INTEGER || pos == NA_INTEGER || pos == 0)
+			continue;
+		if (!_get_cigar(&cigars_holder, i, &cigar) ||
+		    _cigar_is_star(&cigar))
+		{
+			if (errcodes != R_NilValue)
+				INTEGER(errcodes)[i] = CIGAR_IS_NA;
+			continue;
+		}
+		R_xlen_t b0 = first_bin[s - 1];
+		const char *errmsg = bin_cigar_ops(&cigar, pos, op_cols,
+				OP_buf, OPL_buf,
+				REAL(ans_events) + b0, REAL(ans_bases) + b0,
+				nrow, seq_ends[s - 1], bin_width0);
+		if (errmsg != NULL) {
+			if (errcodes == R_NilValue) {
+				UNPROTECT(4);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			INTEGER(errcodes)[i] = _errmsg_as_errcode(errmsg);
+		}
+	}
+
+	SEXP ans = PROTECT(NEW_LIST(3));
+	SET_VECTOR_ELT(ans, 0, ans_nbins);
+	SET_VECTOR_ELT(ans, 1, ans_events);
+	SET_VECTOR_ELT(ans, 2, ans_bases);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(5);
+	return ans;
+}
@@ -0,0 +1,16 @@
+#ifndef _CIGAR_DENSITY_H_
+#define _CIGAR_DENSITY_H_
+
+#include <Rdefines.h>
+
+SEXP C_bin_cigar_ops_along_ref(
+	SEXP cigars,
+	SEXP lmmpos,
+	SEXP seqnames,
+	SEXP seqlengths,
+	SEXP bin_width,
+	SEXP ops,
+	SEXP na_on_error
+);
+
+#endif  /* _CIGAR_DENSITY_H_ */
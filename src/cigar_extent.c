@@ -2,74 +2,384 @@
 
 #include "cigar_ops_visibility.h"
 #include "explode_cigars.h"
+#include "bam_cigars.h"
 
+#include <R_ext/Altrep.h>
 
-static const char *compute_cigar_extent(const char *cigar_string, int space,
-					int *extent)
+#include <limits.h>  /* for INT_MAX, INT_MIN */
+#include <string.h>  /* for memcpy() */
+
+
+/* 'ans' is an integer or double vector. */
+static void set_extent(SEXP ans, R_xlen_t i, long long extent, int is_NA)
+{
+	if (TYPEOF(ans) == INTSXP)
+		INTEGER(ans)[i] = is_NA ? NA_INTEGER : (int) extent;
+	else
+		REAL(ans)[i] = is_NA ? NA_REAL : (double) extent;
+	return;
+}
+
+/* Computes the extent of the i-th CIGAR in 'cigars_holder'. 'flags' is
+   NULL or points to the flag of the i-th alignment.
+   Returns 0 on success, -1 if the alignment is unmapped, or an error code
+   (see _errmsg_as_errcode()) if the CIGAR is NA, "*", or cannot be parsed.
+   In the latter case, '*errmsg' is set to the parsing error. */
+static int get_extent(const CigarsHolder *cigars_holder, R_xlen_t i,
+		int space, const int *flags, const int *precomputed,
+		long long *extent, const char **errmsg)
 {
-	int x, cigar_offset, n, OPL /* Operation Length */;
-	char OP /* Operation */;
+	Cigar cigar;
 
-	x = cigar_offset = 0;
-	while ((n = _next_cigar_OP(cigar_string, cigar_offset, &OP, &OPL))) {
-		if (n == -1)
-			return _get_cigar_parsing_error();
-		if (_op_is_visible(OP, space))
-			x += OPL;
-		cigar_offset += n;
+	if (flags != NULL && (*flags & 0x004))
+		return -1;
+	if (precomputed != NULL) {
+		*extent = precomputed[i];
+		return precomputed[i] == NA_INTEGER ? CIGAR_IS_NA : 0;
 	}
-	*extent = x;
-	return NULL;
+	if (!_get_cigar(cigars_holder, i, &cigar) || _cigar_is_star(&cigar))
+		return CIGAR_IS_NA;
+	*errmsg = _compute_cigar_extent(&cigar, space, extent);
+	if (*errmsg != NULL)
+		return _errmsg_as_errcode(*errmsg);
+	return 0;
 }
 
 /* --- .Call ENTRY POINT ---
    Args:
    cigars, space, flags: see C_cigars_as_ranges() in src/cigars_as_ranges.c
+   na_on_error: TRUE or FALSE. If TRUE, then a CIGAR that is NA, "*", or
+                that cannot be parsed gets an NA extent and an error code
+                (see _errmsg_as_errcode()) is recorded in the "errcode"
+                attribute of the returned vector. If FALSE, then an error
+                is raised on the first CIGAR that cannot be parsed.
    Returns an integer vector of the same length as 'cigars' containing the
-   extents of the alignments as inferred from the cigars information. */
-SEXP C_cigar_extent(SEXP cigars, SEXP space, SEXP flags)
+   extents of the alignments as inferred from the cigars information.
+   The vector is turned into a double vector as soon as an extent that
+   doesn't fit in an int is found (e.g. for chromosome-scale alignments). */
+SEXP C_cigar_extent(SEXP cigars, SEXP space, SEXP flags, SEXP na_on_error)
 {
 	SEXP ans;
-	int space0, i, *ans_elt;
-	const int *flags_elt;
-	const char *cigar_string, *errmsg;
+	PROTECT_INDEX ans_pidx;
+	const int *flags_elt = NULL;
+	const char *errmsg;
 
-	int ncigars = LENGTH(cigars);
+	CigarsHolder cigars_holder = _new_CigarsHolder(cigars);
+	R_xlen_t ncigars = cigars_holder.length, i;
 	if (flags != R_NilValue)
 		flags_elt = INTEGER(flags);
-	space0 = INTEGER(space)[0];
-	PROTECT(ans = NEW_INTEGER(ncigars));
-	for (i = 0, ans_elt = INTEGER(ans); i < ncigars; i++, ans_elt++) {
-		if (flags != R_NilValue) {
-			if (*flags_elt == NA_INTEGER) {
-				UNPROTECT(1);
-				error("'flags' contains NAs");
-			}
-			if (*flags_elt & 0x004) {
-				*ans_elt = NA_INTEGER;
-				goto for_tail;
-			}
+	int space0 = INTEGER(space)[0];
+	const int *precomputed = _get_precomputed_extents(&cigars_holder,
+							  space0);
+	PROTECT_WITH_INDEX(ans = NEW_INTEGER(ncigars), &ans_pidx);
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, ncigars));
+	for (i = 0; i < ncigars; i++) {
+		if (flags_elt != NULL && *flags_elt == NA_INTEGER) {
+			UNPROTECT(2);
+			error("'flags' contains NAs");
 		}
-		SEXP cigars_elt = STRING_ELT(cigars, i);
-		if (cigars_elt == NA_STRING) {
-			*ans_elt = NA_INTEGER;
-			goto for_tail;
+		long long extent;
+		int status = get_extent(&cigars_holder, i, space0, flags_elt,
+					precomputed, &extent, &errmsg);
+		if (flags_elt != NULL)
+			flags_elt++;
+		if (status == -1) {
+			set_extent(ans, i, 0, 1);
+			continue;
 		}
-		cigar_string = CHAR(cigars_elt);
-		if (strcmp(cigar_string, "*") == 0) {
-			*ans_elt = NA_INTEGER;
-			goto for_tail;
+		if (status == CIGAR_IS_NA) {
+			set_extent(ans, i, 0, 1);
+			if (errcodes != R_NilValue)
+				INTEGER(errcodes)[i] = CIGAR_IS_NA;
+			continue;
 		}
-		errmsg = compute_cigar_extent(cigar_string, space0, ans_elt);
-		if (errmsg != NULL) {
-			UNPROTECT(1);
-			error("in 'cigars[%d]': %s", i + 1, errmsg);
+		if (status != 0) {
+			if (errcodes == R_NilValue) {
+				UNPROTECT(2);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			set_extent(ans, i, 0, 1);
+			INTEGER(errcodes)[i] = status;
+			continue;
 		}
-for_tail:
-		if (flags != R_NilValue)
-			flags_elt++;
+		if (TYPEOF(ans) == INTSXP && extent > INT_MAX) {
+			/* Switch to a double vector. Note that the elements
+			   after 'ans[i]' are not set yet so their value
+			   doesn't matter. */
+			REPROTECT(ans = coerceVector(ans, REALSXP), ans_pidx);
+		}
+		set_extent(ans, i, extent, 0);
 	}
-	UNPROTECT(1);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(2);
 	return ans;
 }
 
+
+/****************************************************************************
+ * Lazy extents
+ *
+ * An ALTREP integer vector whose elements are computed from the CIGARs
+ * only when they are accessed. The elements are computed (and cached) by
+ * chunks of LAZY_CHUNK_SIZE elements. The vector is only materialized when
+ * R asks for a pointer to its data. sum(), min() and max() are computed in
+ * a single streaming pass that doesn't materialize the vector.
+ *
+ * data1: a list with the 'cigars', 'space', 'flags', and 'na_on_error'
+ *        arguments passed to C_lazy_cigar_extent(), followed by the
+ *        length of the vector (as a double).
+ * data2: a list with the index of the cached chunk (as a double, -1 if no
+ *        chunk is cached yet), the cached chunk (an integer vector of
+ *        length LAZY_CHUNK_SIZE), and the materialized vector (or NULL).
+ */
+
+#define LAZY_CHUNK_SIZE 4096
+
+static R_altrep_class_t lazy_extents_class;
+
+static R_xlen_t lazy_extents_Length(SEXP x)
+{
+	return (R_xlen_t) REAL(VECTOR_ELT(R_altrep_data1(x), 4))[0];
+}
+
+/* Computes 'x[from + 1]', ..., 'x[from + n]' and stores them in 'out'.
+   The CigarsHolder is rebuilt at each call because a CigarStore object
+   can be closed at any time. */
+static void compute_lazy_extents(SEXP x, R_xlen_t from, R_xlen_t n,
+		int *out)
+{
+	SEXP params = R_altrep_data1(x);
+	SEXP cigars = VECTOR_ELT(params, 0);
+	int space = INTEGER(VECTOR_ELT(params, 1))[0];
+	SEXP flags = VECTOR_ELT(params, 2);
+	int na_on_error = LOGICAL(VECTOR_ELT(params, 3))[0];
+
+	CigarsHolder cigars_holder = _new_CigarsHolder(cigars);
+	const int *precomputed = _get_precomputed_extents(&cigars_holder,
+							  space);
+	const int *flags_elt = flags == R_NilValue ? NULL :
+						     INTEGER(flags) + from;
+	for (R_xlen_t k = 0; k < n; k++) {
+		R_xlen_t i = from + k;
+		long long extent;
+		const char *errmsg;
+		int status = get_extent(&cigars_holder, i, space, flags_elt,
+					precomputed, &extent, &errmsg);
+		if (flags_elt != NULL)
+			flags_elt++;
+		if (status > CIGAR_IS_NA && !na_on_error)
+			error("in 'cigars[%lld]': %s", (long long) i + 1,
+			      errmsg);
+		if (status != 0) {
+			out[k] = NA_INTEGER;
+			continue;
+		}
+		if (extent > INT_MAX)
+			error("the extent of 'cigars[%lld]' is too big to be "
+			      "stored in a lazy integer vector (use "
+			      "'lazy=FALSE' to get a double vector)",
+			      (long long) i + 1);
+		out[k] = (int) extent;
+	}
+	return;
+}
+
+static SEXP get_materialized(SEXP x)
+{
+	return VECTOR_ELT(R_altrep_data2(x), 2);
+}
+
+static void *lazy_extents_Dataptr(SEXP x, Rboolean writeable)
+{
+	SEXP ans = get_materialized(x);
+	if (ans == R_NilValue) {
+		R_xlen_t n = lazy_extents_Length(x);
+		ans = PROTECT(NEW_INTEGER(n));
+		compute_lazy_extents(x, 0, n, INTEGER(ans));
+		SET_VECTOR_ELT(R_altrep_data2(x), 2, ans);
+		UNPROTECT(1);
+	}
+	return (void *) INTEGER(ans);
+}
+
+static const void *lazy_extents_Dataptr_or_null(SEXP x)
+{
+	SEXP ans = get_materialized(x);
+	return ans == R_NilValue ? NULL : (const void *) INTEGER(ans);
+}
+
+static int lazy_extents_Elt(SEXP x, R_xlen_t i)
+{
+	SEXP ans = get_materialized(x);
+	if (ans != R_NilValue)
+		return INTEGER(ans)[i];
+	SEXP cache = R_altrep_data2(x);
+	double *cached_chunk_idx = REAL(VECTOR_ELT(cache, 0));
+	int *chunk = INTEGER(VECTOR_ELT(cache, 1));
+	R_xlen_t chunk_idx = i / LAZY_CHUNK_SIZE;
+	R_xlen_t from = chunk_idx * LAZY_CHUNK_SIZE;
+	if (*cached_chunk_idx != (double) chunk_idx) {
+		R_xlen_t n = lazy_extents_Length(x) - from;
+		if (n > LAZY_CHUNK_SIZE)
+			n = LAZY_CHUNK_SIZE;
+		/* Invalidate the cache first in case an error is raised. */
+		*cached_chunk_idx = -1.0;
+		compute_lazy_extents(x, from, n, chunk);
+		*cached_chunk_idx = (double) chunk_idx;
+	}
+	return chunk[i - from];
+}
+
+static R_xlen_t lazy_extents_Get_region(SEXP x, R_xlen_t i, R_xlen_t n,
+		int *buf)
+{
+	R_xlen_t len = lazy_extents_Length(x);
+	if (n > len - i)
+		n = len - i;
+	SEXP ans = get_materialized(x);
+	if (ans != R_NilValue)
+		memcpy(buf, INTEGER(ans) + i, n * sizeof(int));
+	else
+		compute_lazy_extents(x, i, n, buf);
+	return n;
+}
+
+/* Walks on all the elements of 'x' by chunks and accumulates their sum,
+   min, and max. Returns the number of non-NA elements, or -1 if 'narm'
+   is FALSE and an NA was found. */
+static R_xlen_t lazy_extents_summary(SEXP x, Rboolean narm,
+		double *sum, int *min, int *max)
+{
+	int buf[LAZY_CHUNK_SIZE];
+	R_xlen_t len = lazy_extents_Length(x), nvals = 0;
+
+	*sum = 0.0;
+	*min = INT_MAX;
+	*max = INT_MIN;
+	for (R_xlen_t from = 0; from < len; from += LAZY_CHUNK_SIZE) {
+		R_xlen_t n = lazy_extents_Get_region(x, from,
+						     LAZY_CHUNK_SIZE, buf);
+		for (R_xlen_t k = 0; k < n; k++) {
+			int v = buf[k];
+			if (v == NA_INTEGER) {
+				if (!narm)
+					return -1;
+				continue;
+			}
+			*sum += v;
+			if (v < *min)
+				*min = v;
+			if (v > *max)
+				*max = v;
+			nvals++;
+		}
+	}
+	return nvals;
+}
+
+/* Returning NULL makes R fall back to its default method. We do this when
+   the vector is already materialized, and in the cases where the default
+   method issues a warning (integer overflow or no non-NA values). */
+static SEXP lazy_extents_Sum(SEXP x, Rboolean narm)
+{
+	double sum;
+	int min, max;
+
+	if (get_materialized(x) != R_NilValue)
+		return NULL;
+	if (lazy_extents_summary(x, narm, &sum, &min, &max) == -1)
+		return ScalarInteger(NA_INTEGER);
+	if (sum > INT_MAX)
+		return NULL;
+	return ScalarInteger((int) sum);
+}
+
+static SEXP lazy_extents_Min(SEXP x, Rboolean narm)
+{
+	double sum;
+	int min, max;
+
+	if (get_materialized(x) != R_NilValue)
+		return NULL;
+	R_xlen_t nvals = lazy_extents_summary(x, narm, &sum, &min, &max);
+	if (nvals == -1)
+		return ScalarInteger(NA_INTEGER);
+	if (nvals == 0)
+		return NULL;
+	return ScalarInteger(min);
+}
+
+static SEXP lazy_extents_Max(SEXP x, Rboolean narm)
+{
+	double sum;
+	int min, max;
+
+	if (get_materialized(x) != R_NilValue)
+		return NULL;
+	R_xlen_t nvals = lazy_extents_summary(x, narm, &sum, &min, &max);
+	if (nvals == -1)
+		return ScalarInteger(NA_INTEGER);
+	if (nvals == 0)
+		return NULL;
+	return ScalarInteger(max);
+}
+
+static Rboolean lazy_extents_Inspect(SEXP x, int pre, int deep, int pvec,
+		void (*inspect_subtree)(SEXP, int, int, int))
+{
+	Rprintf(" lazy CIGAR extents (len=%lld, %s)\n",
+		(long long) lazy_extents_Length(x),
+		get_materialized(x) == R_NilValue ? "not materialized" :
+						    "materialized");
+	return TRUE;
+}
+
+void _init_lazy_extents_class(DllInfo *dll)
+{
+	R_altrep_class_t class;
+
+	class = R_make_altinteger_class("lazy_cigar_extents", "cigarillo",
+					dll);
+	R_set_altrep_Length_method(class, lazy_extents_Length);
+	R_set_altrep_Inspect_method(class, lazy_extents_Inspect);
+	R_set_altvec_Dataptr_method(class, lazy_extents_Dataptr);
+	R_set_altvec_Dataptr_or_null_method(class,
+					    lazy_extents_Dataptr_or_null);
+	R_set_altinteger_Elt_method(class, lazy_extents_Elt);
+	R_set_altinteger_Get_region_method(class, lazy_extents_Get_region);
+	R_set_altinteger_Sum_method(class, lazy_extents_Sum);
+	R_set_altinteger_Min_method(class, lazy_extents_Min);
+	R_set_altinteger_Max_method(class, lazy_extents_Max);
+	lazy_extents_class = class;
+	return;
+}
+
+/* --- .Call ENTRY POINT ---
+   Same arguments as C_cigar_extent(). Returns an ALTREP integer vector
+   (see above). Unlike with C_cigar_extent(), the CIGARs that cannot be
+   parsed are only detected when the corresponding elements are accessed,
+   and no "errcode" attribute is set on the returned vector. */
+SEXP C_lazy_cigar_extent(SEXP cigars, SEXP space, SEXP flags,
+		SEXP na_on_error)
+{
+	CigarsHolder cigars_holder = _new_CigarsHolder(cigars);
+	if (flags != R_NilValue) {
+		const int *flags_p = INTEGER(flags);
+		for (R_xlen_t i = 0; i < cigars_holder.length; i++)
+			if (flags_p[i] == NA_INTEGER)
+				error("'flags' contains NAs");
+	}
+	SEXP params = PROTECT(NEW_LIST(5));
+	SET_VECTOR_ELT(params, 0, cigars);
+	SET_VECTOR_ELT(params, 1, space);
+	SET_VECTOR_ELT(params, 2, flags);
+	SET_VECTOR_ELT(params, 3, na_on_error);
+	SET_VECTOR_ELT(params, 4, ScalarReal((double) cigars_holder.length));
+	SEXP cache = PROTECT(NEW_LIST(3));
+	SET_VECTOR_ELT(cache, 0, ScalarReal(-1.0));
+	SET_VECTOR_ELT(cache, 1, NEW_INTEGER(LAZY_CHUNK_SIZE));
+	SEXP ans = R_new_altrep(lazy_extents_class, params, cache);
+	UNPROTECT(2);
+	return ans;
+}
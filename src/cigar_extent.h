@@ -2,11 +2,24 @@
 #define _CIGAR_EXTENT_H_
 
 #include <Rdefines.h>
+#include <R_ext/Rdynload.h>
+
+#include "cigar_core.h"
 
 SEXP C_cigar_extent(
 	SEXP cigars,
 	SEXP space,
-	SEXP flags
+	SEXP flags,
+	SEXP na_on_error
+);
+
+void _init_lazy_extents_class(DllInfo *dll);
+
+SEXP C_lazy_cigar_extent(
+	SEXP cigars,
+	SEXP space,
+	SEXP flags,
+	SEXP na_on_error
 );
 
 #endif  /* _CIGAR_EXTENT_ */
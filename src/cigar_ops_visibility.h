@@ -3,10 +3,7 @@
 
 #include <Rdefines.h>
 
-int _op_is_visible(
-	char OP,
-	int space
-);
+#include "cigar_core.h"
 
 SEXP C_cigar_ops_visibility(SEXP ops);
 
@@ -0,0 +1,342 @@
+#include "cigar_store.h"
+
+#include "cigar_ops_visibility.h"
+#include "explode_cigars.h"
+#include "bam_cigars.h"
+
+#include <stdio.h>   /* for fopen(), fwrite(), remove() */
+#include <stdlib.h>  /* for malloc(), free() */
+#include <string.h>  /* for memcmp(), memset() */
+#include <limits.h>  /* for INT_MAX */
+
+
+/*
+ * A CIGAR store is a binary file that contains a set of alignments in
+ * columnar form:
+ *
+ *   offset  size      content
+ *   ------  --------  -------------------------------------------------
+ *        0         8  magic string "CIGSTOR\0"
+ *        8         4  byte order mark 0x01020304 (uint32)
+ *       12         4  format version (uint32)
+ *       16         8  nb of alignments 'nalign' (int64)
+ *       24         8  total nb of CIGAR words 'nwords' (int64)
+ *       32        32  reserved (zeros)
+ *       64  8*nalign  'ends': cumulative nb of words per alignment (int64)
+ *           4*nwords  'words': BAM-encoded CIGARs (uint32, little-endian)
+ *                     padded with zeros to a multiple of 8 bytes
+ *           4*nalign  'lmmpos' (int32)
+ *           4*nalign  'flags' (int32)
+ *           4*nalign  'ref_extents' (int32, NA for "*")
+ *           4*nalign  'query_extents' (int32, NA for "*")
+ *
+ * The header and the integer columns are written in the native byte order
+ * of the machine that wrote the file. A file can only be opened on a
+ * machine with the same byte order (the byte order mark is used to check
+ * that). Opening a store only maps it in memory and checks its header, so
+ * it takes the same time whatever the size of the file.
+ */
+
+#define HEADER_SIZE 64
+#define FORMAT_VERSION 1
+
+static const char magic[8] = "CIGSTOR";  /* includes the trailing \0 */
+
+static long long padded_words_size(long long nwords)
+{
+	return (4 * nwords + 7) / 8 * 8;
+}
+
+static long long expected_file_size(long long nalign, long long nwords)
+{
+	return HEADER_SIZE + 8 * nalign + padded_words_size(nwords) +
+	       4 * 4 * nalign;
+}
+
+
+/****************************************************************************
+ * C_write_cigar_store()
+ */
+
+static int write_ints(FILE *fp, const int *x, R_xlen_t n, int recycle)
+{
+	if (!recycle)
+		return fwrite(x, sizeof(int), n, fp) == (size_t) n;
+	for (R_xlen_t i = 0; i < n; i++)
+		if (fwrite(x, sizeof(int), 1, fp) != 1)
+			return 0;
+	return 1;
+}
+
+/* Returns NULL on success, or an error message. */
+static const char *compute_extents(const CigarsHolder *holder,
+		int *ref_extents, int *query_extents, R_xlen_t *bad_idx)
+{
+	static char errmsg_buf[200];
+	Cigar cigar;
+
+	for (R_xlen_t i = 0; i < holder->length; i++) {
+		_get_cigar(holder, i, &cigar);
+		if (_cigar_is_star(&cigar)) {
+			ref_extents[i] = query_extents[i] = NA_INTEGER;
+			continue;
+		}
+		long long ref_extent = 0, query_extent = 0;
+		int offset = 0, n, OPL;
+		char OP;
+		while ((n = _next_OP(&cigar, offset, &OP, &OPL))) {
+			if (n == -1) {
+				*bad_idx = i;
+				return _get_cigar_parsing_error();
+			}
+			if (_op_is_visible(OP, REFERENCE))
+				ref_extent += OPL;
+			if (_op_is_visible(OP, QUERY))
+				query_extent += OPL;
+			offset += n;
+		}
+		if (ref_extent > INT_MAX || query_extent > INT_MAX) {
+			*bad_idx = i;
+			snprintf(errmsg_buf, sizeof(errmsg_buf),
+				 "alignment extent is greater than %d",
+				 INT_MAX);
+			return errmsg_buf;
+		}
+		ref_extents[i] = (int) ref_extent;
+		query_extents[i] = (int) query_extent;
+	}
+	return NULL;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   filepath: the path to the file to write.
+ *   cigars:   CompressedRawList object containing BAM-encoded CIGARs.
+ *   lmmpos:   integer vector of length 1 or of the same length as 'cigars'.
+ *   flags:    NULL or an integer vector of the same length as 'cigars'.
+ */
+SEXP C_write_cigar_store(SEXP filepath, SEXP cigars, SEXP lmmpos, SEXP flags)
+{
+	const char *path = R_ExpandFileName(
+				translateChar(STRING_ELT(filepath, 0)));
+	CigarsHolder holder = _new_CigarsHolder(cigars);
+	long long nalign = holder.length;
+	long long nwords = nalign == 0 ? 0 : holder.ends[nalign - 1] / 4;
+
+	/* Compute the extents before creating the file. */
+	int *extents = (int *) malloc(2 * (nalign ? nalign : 1) * sizeof(int));
+	if (extents == NULL)
+		error("cannot allocate memory for the extents");
+	R_xlen_t bad_idx;
+	const char *errmsg = compute_extents(&holder, extents,
+					     extents + nalign, &bad_idx);
+	if (errmsg != NULL) {
+		free(extents);
+		error("in 'cigars[[%lld]]': %s", (long long) bad_idx + 1, errmsg);
+	}
+
+	FILE *fp = fopen(path, "wb");
+	if (fp == NULL) {
+		free(extents);
+		error("cannot open file '%s' for writing", path);
+	}
+	unsigned char header[HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	memcpy(header, magic, sizeof(magic));
+	unsigned int bom = 0x01020304, version = FORMAT_VERSION;
+	memcpy(header + 8, &bom, 4);
+	memcpy(header + 12, &version, 4);
+	memcpy(header + 16, &nalign, 8);
+	memcpy(header + 24, &nwords, 8);
+	int ok = fwrite(header, 1, HEADER_SIZE, fp) == HEADER_SIZE;
+	for (long long i = 0; ok && i < nalign; i++) {
+		long long end = holder.ends[i] / 4;
+		ok = fwrite(&end, 8, 1, fp) == 1;
+	}
+	if (ok && nwords != 0)
+		ok = fwrite(holder.bytes, 4, nwords, fp) == (size_t) nwords;
+	if (ok && 4 * nwords < padded_words_size(nwords)) {
+		static const unsigned char zeros[4] = {0};
+		ok = fwrite(zeros, 1, 4, fp) == 4;
+	}
+	if (ok)
+		ok = write_ints(fp, INTEGER(lmmpos), nalign, LENGTH(lmmpos) == 1);
+	if (ok && flags != R_NilValue) {
+		ok = write_ints(fp, INTEGER(flags), nalign, 0);
+	} else if (ok) {
+		int zero = 0;
+		ok = write_ints(fp, &zero, nalign, 1);
+	}
+	if (ok)
+		ok = write_ints(fp, extents, 2 * nalign, 0);
+	free(extents);
+	if (fclose(fp) != 0)
+		ok = 0;
+	if (!ok) {
+		remove(path);
+		error("error while writing file '%s'", path);
+	}
+	return R_NilValue;
+}
+
+
+/****************************************************************************
+ * C_open_cigar_store() and C_close_cigar_store()
+ */
+
+static void free_store(CigarStore *store)
+{
+	_unmap_file(&store->mf);
+	free(store);
+	return;
+}
+
+static void cigar_store_finalizer(SEXP xp)
+{
+	CigarStore *store = (CigarStore *) R_ExternalPtrAddr(xp);
+	if (store == NULL)
+		return;
+	free_store(store);
+	R_ClearExternalPtr(xp);
+	return;
+}
+
+/* Returns NULL on success, or an error message. Only the header is read. */
+static const char *set_store_pointers(CigarStore *store)
+{
+	const char *data = store->mf.data;
+	size_t size = store->mf.size;
+	unsigned int bom, version;
+
+	if (size < HEADER_SIZE || memcmp(data, magic, sizeof(magic)) != 0)
+		return "not a CIGAR store file";
+	memcpy(&bom, data + 8, 4);
+	if (bom != 0x01020304)
+		return "CIGAR store file was written on a machine with "
+		       "a different byte order";
+	memcpy(&version, data + 12, 4);
+	if (version != FORMAT_VERSION)
+		return "unsupported CIGAR store format version";
+	memcpy(&store->nalign, data + 16, 8);
+	memcpy(&store->nwords, data + 24, 8);
+	/* Each alignment takes 24 bytes after the header (8 for its end and
+	   4 for each of the 4 integer columns). Checking 'nalign' and 'nwords'
+	   against the file size first guarantees that expected_file_size()
+	   cannot overflow. */
+	if (store->nalign < 0 || store->nwords < 0 ||
+	    (unsigned long long) store->nalign > (size - HEADER_SIZE) / 24 ||
+	    (unsigned long long) store->nwords > size ||
+	    (long long) size != expected_file_size(store->nalign,
+						   store->nwords))
+		return "CIGAR store file is truncated or corrupted";
+	const char *p = data + HEADER_SIZE;
+	store->ends = (const long long *) p;
+	p += 8 * store->nalign;
+	store->words = (const unsigned char *) p;
+	p += padded_words_size(store->nwords);
+	store->lmmpos = (const int *) p;
+	p += 4 * store->nalign;
+	store->flags = (const int *) p;
+	p += 4 * store->nalign;
+	store->ref_extents = (const int *) p;
+	p += 4 * store->nalign;
+	store->query_extents = (const int *) p;
+	if (store->nalign != 0 &&
+	    store->ends[store->nalign - 1] != store->nwords)
+		return "CIGAR store file is corrupted";
+	return NULL;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Maps the file in memory and returns an external pointer to a CigarStore
+ * struct. The file is unmapped when the external pointer is garbage
+ * collected or when C_close_cigar_store() is called on it.
+ */
+SEXP C_open_cigar_store(SEXP filepath)
+{
+	const char *path = R_ExpandFileName(
+				translateChar(STRING_ELT(filepath, 0)));
+	CigarStore *store = (CigarStore *) malloc(sizeof(CigarStore));
+	if (store == NULL)
+		error("cannot allocate memory");
+	const char *errmsg = _map_file(path, 0, 0, &store->mf);
+	if (errmsg == NULL)
+		errmsg = set_store_pointers(store);
+	if (errmsg != NULL) {
+		free_store(store);
+		error("%s '%s'", errmsg, path);
+	}
+	SEXP xp = PROTECT(R_MakeExternalPtr(store, R_NilValue, R_NilValue));
+	R_RegisterCFinalizerEx(xp, cigar_store_finalizer, TRUE);
+	UNPROTECT(1);
+	return xp;
+}
+
+/* --- .Call ENTRY POINT --- */
+SEXP C_close_cigar_store(SEXP xp)
+{
+	cigar_store_finalizer(xp);
+	return R_NilValue;
+}
+
+
+/****************************************************************************
+ * Accessing a CigarStore
+ */
+
+static const CigarStore *store_from_xp(SEXP xp)
+{
+	const CigarStore *store = (const CigarStore *) R_ExternalPtrAddr(xp);
+	if (store == NULL)
+		error("CigarStore object is closed or was restored from a "
+		      "previous session (use open_cigar_store() to reopen "
+		      "the file)");
+	return store;
+}
+
+/* Returns NULL if 'x' is not a CigarStore object. */
+const CigarStore *_get_CigarStore(SEXP x)
+{
+	static SEXP xp_symbol = NULL;
+
+	if (!inherits(x, "CigarStore"))
+		return NULL;
+	if (xp_symbol == NULL)
+		xp_symbol = install("xp");
+	return store_from_xp(GET_SLOT(x, xp_symbol));
+}
+
+/* --- .Call ENTRY POINT --- */
+SEXP C_cigar_store_length(SEXP xp)
+{
+	const CigarStore *store = store_from_xp(xp);
+	if (store->nalign > INT_MAX)
+		return ScalarReal((double) store->nalign);
+	return ScalarInteger((int) store->nalign);
+}
+
+/* --- .Call ENTRY POINT ---
+ * Returns a copy of one of the integer columns of the store.
+ */
+SEXP C_cigar_store_column(SEXP xp, SEXP colname)
+{
+	const CigarStore *store = store_from_xp(xp);
+	const char *colname0 = CHAR(STRING_ELT(colname, 0));
+	const int *col;
+	if (strcmp(colname0, "lmmpos") == 0) {
+		col = store->lmmpos;
+	} else if (strcmp(colname0, "flags") == 0) {
+		col = store->flags;
+	} else if (strcmp(colname0, "ref_extent") == 0) {
+		col = store->ref_extents;
+	} else if (strcmp(colname0, "query_extent") == 0) {
+		col = store->query_extents;
+	} else {
+		error("invalid column name: %s", colname0);
+	}
+	SEXP ans = PROTECT(NEW_INTEGER((R_xlen_t) store->nalign));
+	memcpy(INTEGER(ans), col, sizeof(int) * store->nalign);
+	UNPROTECT(1);
+	return ans;
+}
+
@@ -0,0 +1,43 @@
+#ifndef _CIGAR_STORE_H_
+#define _CIGAR_STORE_H_
+
+#include <Rdefines.h>
+
+#include "mapped_file.h"
+
+/* A CIGAR store file once mapped in memory. All the pointers point inside
+   the mapping. */
+typedef struct cigar_store_t {
+	MappedFile mf;
+	long long nalign;
+	long long nwords;
+	const long long *ends;  /* cumulative nb of words */
+	const unsigned char *words;
+	const int *lmmpos;
+	const int *flags;
+	const int *ref_extents;
+	const int *query_extents;
+} CigarStore;
+
+const CigarStore *_get_CigarStore(SEXP x);
+
+SEXP C_write_cigar_store(
+	SEXP filepath,
+	SEXP cigars,
+	SEXP lmmpos,
+	SEXP flags
+);
+
+SEXP C_open_cigar_store(SEXP filepath);
+
+SEXP C_close_cigar_store(SEXP xp);
+
+SEXP C_cigar_store_length(SEXP xp);
+
+SEXP C_cigar_store_column(
+	SEXP xp,
+	SEXP colname
+);
+
+#endif  /* _CIGAR_STORE_H_ */
+
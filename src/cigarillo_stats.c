@@ -0,0 +1,345 @@
+#include "cigarillo_stats.h"
+
+#include "cigar_core.h"
+
+#include <string.h>  /* for strcmp(), strncpy(), memset() */
+#include <time.h>    /* for clock_gettime() or timespec_get() */
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/* Per-entry point statistics collected when the "cigarillo.stats" option
+   is set to TRUE. The recording is driven from R (see .recorded_Call() in
+   R/utils.R): C_stats_begin() is called right before the .Call entry point
+   and C_stats_end() right after it.
+   The low-level counters (ops tokenized, bytes scanned, buffer growths)
+   are incremented by the kernels with atomic operations (see the STATS_*
+   macros in cigar_core.h). The table below is only touched by the R main
+   thread.
+   When the option is set to "perf", the hardware counters of the CPU are
+   also read around each call (Linux only, see below). */
+
+#define MAX_ENTRY_POINTS 64
+#define MAX_NAME_LENGTH  48
+
+#define HW_CYCLES        0
+#define HW_INSTRUCTIONS  1
+#define HW_BRANCH_MISSES 2
+#define HW_LLC_MISSES    3
+#define NHW_COUNTERS     4
+
+typedef struct call_stats_t {
+	char name[MAX_NAME_LENGTH];
+	long long ncalls;
+	double nelt;
+	long long counters[STATS_NCOUNTERS];
+	double out_bytes;
+	double seconds;
+	double hw_counters[NHW_COUNTERS];
+	int hw_recorded[NHW_COUNTERS];
+} CallStats;
+
+static CallStats call_stats[MAX_ENTRY_POINTS];
+static int ncall_stats = 0;
+
+static long long counters0[STATS_NCOUNTERS];
+static double time0;
+static int recording_hw;
+
+static double now(void)
+{
+	struct timespec ts;
+#ifdef _WIN32
+	timespec_get(&ts, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+static CallStats *get_call_stats(const char *name)
+{
+	for (int k = 0; k < ncall_stats; k++)
+		if (strcmp(call_stats[k].name, name) == 0)
+			return call_stats + k;
+	if (ncall_stats == MAX_ENTRY_POINTS)
+		return NULL;
+	CallStats *stats = call_stats + ncall_stats++;
+	memset(stats, 0, sizeof(CallStats));
+	strncpy(stats->name, name, MAX_NAME_LENGTH - 1);
+	return stats;
+}
+
+/* Approximate number of bytes of the data part of 'x' (attributes are not
+   counted). The CHARSXPs are counted every time they're referenced even
+   though R shares them via its global CHARSXP cache. */
+static double object_bytes(SEXP x)
+{
+	double nbytes = 0.0;
+	R_xlen_t n, i;
+
+	switch (TYPEOF(x)) {
+	    case LGLSXP: case INTSXP:
+		nbytes = (double) XLENGTH(x) * sizeof(int);
+		break;
+	    case REALSXP:
+		nbytes = (double) XLENGTH(x) * sizeof(double);
+		break;
+	    case RAWSXP:
+		nbytes = (double) XLENGTH(x);
+		break;
+	    case CHARSXP:
+		nbytes = (double) LENGTH(x) + 1;
+		break;
+	    case STRSXP:
+		n = XLENGTH(x);
+		nbytes = (double) n * sizeof(SEXP);
+		for (i = 0; i < n; i++)
+			nbytes += object_bytes(STRING_ELT(x, i));
+		break;
+	    case VECSXP:
+		n = XLENGTH(x);
+		nbytes = (double) n * sizeof(SEXP);
+		for (i = 0; i < n; i++)
+			nbytes += object_bytes(VECTOR_ELT(x, i));
+		break;
+	}
+	return nbytes;
+}
+
+
+/****************************************************************************
+ * Hardware counters
+ *
+ * On Linux, the counters are opened with perf_event_open(2) the first time
+ * they're needed, and kept open for the rest of the session. They count
+ * the user-space events of the calling thread only. Each counter is opened
+ * separately so the counters that are not supported by the CPU (or by the
+ * VM) don't prevent the others from being used. When there are more
+ * counters than hardware registers, the kernel multiplexes them and the
+ * values are scaled by the fraction of the time they were running.
+ * Note that the access to these counters is controlled by the
+ * /proc/sys/kernel/perf_event_paranoid setting.
+ */
+
+static int hw_fds[NHW_COUNTERS];
+static int hw_fds_state = 0;  /* 0: not opened yet, 1: opened */
+
+#ifdef __linux__
+static int open_hw_counter(unsigned long long config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void open_hw_counters(void)
+{
+	for (int k = 0; k < NHW_COUNTERS; k++)
+		hw_fds[k] = -1;
+#ifdef __linux__
+	static const unsigned long long configs[NHW_COUNTERS] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES,
+		PERF_COUNT_HW_CACHE_MISSES  /* usually the LLC misses */
+	};
+	for (int k = 0; k < NHW_COUNTERS; k++)
+		hw_fds[k] = open_hw_counter(configs[k]);
+#endif
+	hw_fds_state = 1;
+	return;
+}
+
+static void start_hw_counters(void)
+{
+#ifdef __linux__
+	for (int k = 0; k < NHW_COUNTERS; k++) {
+		if (hw_fds[k] < 0)
+			continue;
+		ioctl(hw_fds[k], PERF_EVENT_IOC_RESET, 0);
+		ioctl(hw_fds[k], PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+	return;
+}
+
+/* Stops the counters and stores their values in 'values'. The values of
+   the counters that are not available are set to -1. */
+static void stop_hw_counters(double *values)
+{
+	for (int k = 0; k < NHW_COUNTERS; k++)
+		values[k] = -1.0;
+#ifdef __linux__
+	for (int k = 0; k < NHW_COUNTERS; k++)
+		if (hw_fds[k] >= 0)
+			ioctl(hw_fds[k], PERF_EVENT_IOC_DISABLE, 0);
+	for (int k = 0; k < NHW_COUNTERS; k++) {
+		/* value, time enabled, time running */
+		unsigned long long buf[3];
+		if (hw_fds[k] < 0 ||
+		    read(hw_fds[k], buf, sizeof(buf)) != sizeof(buf))
+			continue;
+		double value = (double) buf[0];
+		if (buf[2] != 0 && buf[2] < buf[1])
+			value *= (double) buf[1] / (double) buf[2];
+		values[k] = value;
+	}
+#endif
+	return;
+}
+
+
+/****************************************************************************
+ * Recording a .Call
+ */
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   hw: TRUE or FALSE. Whether to also read the hardware counters.
+ * Returns the number of hardware counters that are available (always 0 if
+ * 'hw' is FALSE).
+ */
+SEXP C_stats_begin(SEXP hw)
+{
+	int nhw = 0;
+
+	recording_hw = LOGICAL(hw)[0];
+	if (recording_hw) {
+		if (hw_fds_state == 0)
+			open_hw_counters();
+		for (int k = 0; k < NHW_COUNTERS; k++)
+			if (hw_fds[k] >= 0)
+				nhw++;
+	}
+	for (int j = 0; j < STATS_NCOUNTERS; j++)
+		counters0[j] = STATS_ATOMIC_LOAD(_stats_counters + j);
+	_stats_enabled = 1;
+	time0 = now();
+	if (nhw != 0)
+		start_hw_counters();
+	return ScalarInteger(nhw);
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   name: the name of the .Call entry point that was called.
+ *   nelt: a single double. The number of input elements (typically the
+ *         length of 'cigars').
+ *   ans:  what the entry point returned, or NULL if it raised an error.
+ */
+SEXP C_stats_end(SEXP name, SEXP nelt, SEXP ans)
+{
+	double hw_values[NHW_COUNTERS];
+	int hw = recording_hw;
+	if (hw)
+		stop_hw_counters(hw_values);
+	double seconds = now() - time0;
+	_stats_enabled = 0;
+	recording_hw = 0;
+	CallStats *stats = get_call_stats(CHAR(STRING_ELT(name, 0)));
+	if (stats == NULL)
+		return R_NilValue;
+	for (int k = 0; hw && k < NHW_COUNTERS; k++) {
+		if (hw_values[k] < 0.0)
+			continue;
+		stats->hw_counters[k] += hw_values[k];
+		stats->hw_recorded[k] = 1;
+	}
+	stats->ncalls++;
+	stats->nelt += REAL(nelt)[0];
+	for (int j = 0; j < STATS_NCOUNTERS; j++)
+		stats->counters[j] += STATS_ATOMIC_LOAD(_stats_counters + j) -
+				      counters0[j];
+	stats->out_bytes += object_bytes(ans);
+	stats->seconds += seconds;
+	return R_NilValue;
+}
+
+
+/****************************************************************************
+ * C_get_cigarillo_stats()
+ */
+
+static SEXP new_stats_col(SEXPTYPE type, const char *colname, SEXP colnames,
+		int j)
+{
+	SET_STRING_ELT(colnames, j, mkChar(colname));
+	return allocVector(type, ncall_stats);
+}
+
+/* --- .Call ENTRY POINT ---
+ * Returns the statistics as a named list of 12 parallel vectors (one
+ * element per entry point that was called). The hardware counters that
+ * were never recorded for an entry point are set to NA. If 'reset' is
+ * TRUE, the statistics are cleared afterwards.
+ */
+SEXP C_get_cigarillo_stats(SEXP reset)
+{
+	static const char *counter_names[STATS_NCOUNTERS] = {
+		"ops", "bytes_scanned", "buf_growths"
+	};
+	static const char *hw_counter_names[NHW_COUNTERS] = {
+		"cycles", "instructions", "branch_misses", "llc_misses"
+	};
+	int ncol = 5 + STATS_NCOUNTERS + NHW_COUNTERS;
+	SEXP ans = PROTECT(NEW_LIST(ncol));
+	SEXP ans_names = PROTECT(NEW_CHARACTER(ncol));
+	int j = 0;
+
+	SEXP ans_name = new_stats_col(STRSXP, "name", ans_names, j);
+	SET_VECTOR_ELT(ans, j++, ans_name);
+	SEXP ans_calls = new_stats_col(REALSXP, "calls", ans_names, j);
+	SET_VECTOR_ELT(ans, j++, ans_calls);
+	SEXP ans_nelt = new_stats_col(REALSXP, "elements", ans_names, j);
+	SET_VECTOR_ELT(ans, j++, ans_nelt);
+	for (int c = 0; c < STATS_NCOUNTERS; c++) {
+		SEXP ans_col = new_stats_col(REALSXP, counter_names[c],
+					     ans_names, j);
+		SET_VECTOR_ELT(ans, j++, ans_col);
+		for (int k = 0; k < ncall_stats; k++)
+			REAL(ans_col)[k] = (double) call_stats[k].counters[c];
+	}
+	SEXP ans_out_bytes = new_stats_col(REALSXP, "out_bytes", ans_names, j);
+	SET_VECTOR_ELT(ans, j++, ans_out_bytes);
+	SEXP ans_seconds = new_stats_col(REALSXP, "seconds", ans_names, j);
+	SET_VECTOR_ELT(ans, j++, ans_seconds);
+	for (int c = 0; c < NHW_COUNTERS; c++) {
+		SEXP ans_col = new_stats_col(REALSXP, hw_counter_names[c],
+					     ans_names, j);
+		SET_VECTOR_ELT(ans, j++, ans_col);
+		for (int k = 0; k < ncall_stats; k++)
+			REAL(ans_col)[k] = call_stats[k].hw_recorded[c] ?
+					   call_stats[k].hw_counters[c] :
+					   NA_REAL;
+	}
+
+	for (int k = 0; k < ncall_stats; k++) {
+		const CallStats *stats = call_stats + k;
+		SET_STRING_ELT(ans_name, k, mkChar(stats->name));
+		REAL(ans_calls)[k] = (double) stats->ncalls;
+		REAL(ans_nelt)[k] = stats->nelt;
+		REAL(ans_out_bytes)[k] = stats->out_bytes;
+		REAL(ans_seconds)[k] = stats->seconds;
+	}
+	SET_NAMES(ans, ans_names);
+	if (LOGICAL(reset)[0])
+		ncall_stats = 0;
+	UNPROTECT(2);
+	return ans;
+}
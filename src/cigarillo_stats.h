@@ -0,0 +1,16 @@
+#ifndef _CIGARILLO_STATS_H_
+#define _CIGARILLO_STATS_H_
+
+#include <Rdefines.h>
+
+SEXP C_stats_begin(SEXP hw);
+
+SEXP C_stats_end(
+	SEXP name,
+	SEXP nelt,
+	SEXP ans
+);
+
+SEXP C_get_cigarillo_stats(SEXP reset);
+
+#endif  /* _CIGARILLO_STATS_H_ */
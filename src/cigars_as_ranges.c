@@ -5,8 +5,10 @@
 
 #include "cigar_ops_visibility.h"
 #include "explode_cigars.h"
+#include "bam_cigars.h"
 
-#include <string.h>  /* for memcpy() */
+#include <string.h>  /* for memcpy(), strchr() */
+#include <limits.h>  /* for INT_MAX */
 
 
 /* TODO: This should go in the IRanges package and be exposed
@@ -116,7 +118,9 @@ static void drop_or_append_or_merge_range(int start, int width,
 		}
 	}
 	/* Append. */
+	const int *elts0 = range_buf->a->elts;
 	IntPairAE_insert_at(range_buf, buf_nelt, start, width);
+	STATS_COUNT_GROWTH(elts0, range_buf->a->elts);
 	if (OP_buf != NULL) {
 		CharAE *new_elt = new_CharAE(1);
 		CharAE_insert_at(new_elt, 0, OP);
@@ -133,7 +137,7 @@ static void drop_or_append_or_merge_range(int start, int width,
 }
 
 /* Make sure _init_ops_lkup_table() is called before parse_cigar_ranges(). */
-static const char *parse_cigar_ranges(const char *cigar_string,
+static const char *parse_cigar_ranges(const Cigar *cigar,
 		int space, int lmmpos,
 		int drop_empty_ranges, int reduce_ranges,
 		IntPairAE *range_buf,
@@ -144,7 +148,7 @@ static const char *parse_cigar_ranges(const char *cigar_string,
 	int start = lmmpos;
 	int n, OPL /* Operation Length */;
 	char OP /* Operation */;
-	while ((n = _next_cigar_OP(cigar_string, cigar_offset, &OP, &OPL))) {
+	while ((n = _next_OP(cigar, cigar_offset, &OP, &OPL))) {
 		if (n == -1)
 			return _get_cigar_parsing_error();
 		int width = _op_is_visible(OP, space) ? OPL : 0;
@@ -162,26 +166,114 @@ static const char *parse_cigar_ranges(const char *cigar_string,
 }
 
 
+/* Drop the ranges (and their ops and oplens) that were appended to the
+   buffers after the first 'nelt' ranges. Used to discard the ranges
+   produced by a CIGAR that turns out to be invalid. */
+static void truncate_range_bufs(int nelt, IntPairAE *range_buf,
+		CharAEAE *OP_buf, IntAE *OPL_buf1, IntAEAE *OPL_buf2)
+{
+	IntPairAE_set_nelt(range_buf, nelt);
+	if (OP_buf != NULL)
+		CharAEAE_set_nelt(OP_buf, nelt);
+	if (OPL_buf1 != NULL)
+		IntAE_set_nelt(OPL_buf1, nelt);
+	if (OPL_buf2 != NULL)
+		IntAEAE_set_nelt(OPL_buf2, nelt);
+	return;
+}
+
+
 /****************************************************************************
  * C_cigars_as_ranges()
  */
 
-static SEXP make_list_of_IRanges(const IntPairAEAE *range_buf, SEXP names)
+/* Group the ranges in 'range_buf' (and their ops and oplens) by factor
+   level. The ranges produced by the i-th CIGAR are the ranges that precede
+   'cigar_ends[i]' in the buffers, and they go to level 'f_p[i]'. This is a
+   stable counting sort: we count the ranges that go to each level, which
+   gives us the breakpoints of the returned CompressedIRangesList object,
+   then scatter the blocks of ranges into place. The ranges of a given level
+   stay in the order of the CIGARs that produced them. The elements of
+   'OP_buf' and 'OPL_buf2' are moved (not copied) to the new buffers. */
+static void group_range_bufs_by_level(R_xlen_t cigar_len,
+		const int *cigar_ends, const int *f_p, int nlevels,
+		int *breakpoints,
+		IntPairAE **range_buf,
+		CharAEAE **OP_buf, IntAE **OPL_buf1, IntAEAE **OPL_buf2)
 {
-	SEXP ans = PROTECT(new_list_of_IRanges_from_IntPairAEAE("IRanges",
-								range_buf));
-	//SEXP ans_names = PROTECT(duplicate(names));
-	//SET_NAMES(ans, ans_names);
-	//UNPROTECT(2);
-	SET_NAMES(ans, names);
-	UNPROTECT(1);
-	return ans;
+	/* 1st pass: count the ranges that go to each level. */
+	memset(breakpoints, 0, sizeof(int) * nlevels);
+	int prev_end = 0;
+	for (R_xlen_t i = 0; i < cigar_len; i++) {
+		int nranges = cigar_ends[i] - prev_end;
+		if (nranges != 0)
+			breakpoints[f_p[i] - 1] += nranges;
+		prev_end = cigar_ends[i];
+	}
+	int *offsets = (int *) R_alloc(nlevels, sizeof(int));
+	int offset = 0;
+	for (int k = 0; k < nlevels; k++) {
+		offsets[k] = offset;
+		offset += breakpoints[k];
+		breakpoints[k] = offset;
+	}
+
+	/* 2nd pass: scatter the ranges into place. */
+	size_t nelt = offset;
+	IntPairAE *grouped_range_buf = new_IntPairAE(nelt, nelt);
+	CharAEAE *grouped_OP_buf = NULL;
+	IntAE *grouped_OPL_buf1 = NULL;
+	IntAEAE *grouped_OPL_buf2 = NULL;
+	if (*OP_buf != NULL)
+		grouped_OP_buf = new_CharAEAE(nelt, 0);
+	if (*OPL_buf1 != NULL)
+		grouped_OPL_buf1 = new_IntAE(nelt, nelt, 0);
+	if (*OPL_buf2 != NULL)
+		grouped_OPL_buf2 = new_IntAEAE(nelt, 0);
+	prev_end = 0;
+	for (R_xlen_t i = 0; i < cigar_len; i++) {
+		int from = prev_end, nranges = cigar_ends[i] - from;
+		prev_end = cigar_ends[i];
+		if (nranges == 0)
+			continue;
+		int to = offsets[f_p[i] - 1];
+		offsets[f_p[i] - 1] += nranges;
+		memcpy(grouped_range_buf->a->elts + to,
+		       (*range_buf)->a->elts + from, sizeof(int) * nranges);
+		memcpy(grouped_range_buf->b->elts + to,
+		       (*range_buf)->b->elts + from, sizeof(int) * nranges);
+		if (grouped_OP_buf != NULL)
+			memcpy(grouped_OP_buf->elts + to,
+			       (*OP_buf)->elts + from,
+			       sizeof(CharAE *) * nranges);
+		if (grouped_OPL_buf1 != NULL)
+			memcpy(grouped_OPL_buf1->elts + to,
+			       (*OPL_buf1)->elts + from,
+			       sizeof(int) * nranges);
+		if (grouped_OPL_buf2 != NULL)
+			memcpy(grouped_OPL_buf2->elts + to,
+			       (*OPL_buf2)->elts + from,
+			       sizeof(IntAE *) * nranges);
+	}
+	*range_buf = grouped_range_buf;
+	if (grouped_OP_buf != NULL) {
+		CharAEAE_set_nelt(grouped_OP_buf, nelt);
+		*OP_buf = grouped_OP_buf;
+	}
+	if (grouped_OPL_buf1 != NULL)
+		*OPL_buf1 = grouped_OPL_buf1;
+	if (grouped_OPL_buf2 != NULL) {
+		IntAEAE_set_nelt(grouped_OPL_buf2, nelt);
+		*OPL_buf2 = grouped_OPL_buf2;
+	}
+	return;
 }
 
 static SEXP make_CompressedIRangesList(const IntPairAE *range_buf,
 		SEXP breakpoints,
 		const CharAEAE *OP_buf,
-		const IntAE *OPL_buf1, const IntAEAE *OPL_buf2)
+		const IntAE *OPL_buf1, const IntAEAE *OPL_buf2,
+		SEXP names)
 {
 	SEXP unlisted_ans =
 		PROTECT(new_IRanges_from_IntPairAE("IRanges", range_buf));
@@ -202,7 +294,7 @@ static SEXP make_CompressedIRangesList(const IntPairAE *range_buf,
 	}
 	SEXP ans_partitioning =
 		PROTECT(new_PartitioningByEnd("PartitioningByEnd",
-					      breakpoints, NULL));
+					      breakpoints, names));
 	SEXP ans =
 		PROTECT(new_CompressedList("CompressedIRangesList",
 					   unlisted_ans, ans_partitioning));
@@ -212,7 +304,9 @@ static SEXP make_CompressedIRangesList(const IntPairAE *range_buf,
 
 /* --- .Call ENTRY POINT ---
    Args:
-     cigars: character vector containing extended CIGAR strings.
+     cigars: character vector containing extended CIGAR strings, or
+             CompressedRawList object containing BAM-encoded CIGARs (see
+             src/bam_cigars.c).
      space:  single integer indicating one of the 8 supported spaces (defined
              at the top of the cigar_extent.c file).
      flags:  NULL or an integer vector of the same length as 'cigars'
@@ -224,11 +318,10 @@ static SEXP make_CompressedIRangesList(const IntPairAE *range_buf,
              containing the 1-based leftmost position/coordinate of the
              clipped read sequences.
      f:      NULL or a factor of length 'cigars'. If NULL, then the ranges are
-             grouped by alignment and stored in a CompressedIRangesList object
-             with 1 list element per element in 'cigars'. If a factor, then
-             they are grouped by factor level and stored in an ordinary list
-             of IRanges objects with 1 list element per level in 'f' and named
-             with those levels.
+             grouped by alignment, with 1 list element per element in
+             'cigars'. If a factor, then they are grouped by factor level,
+             with 1 list element per level in 'f', and the list elements are
+             named with those levels.
      ops:    NULL or a character vector containing the CIGAR operations to
              translate to ranges. If NULL, then all CIGAR operations are
              translated.
@@ -236,65 +329,76 @@ static SEXP make_CompressedIRangesList(const IntPairAE *range_buf,
      reduce_ranges: TRUE or FALSE.
      with_ops: TRUE or FALSE indicating whether the returned ranges should be
              named with their corresponding CIGAR operation.
+     with_oplens: TRUE or FALSE indicating whether the returned ranges should
+             have an "oplen" metadata column.
+     na_on_error: TRUE or FALSE. If TRUE, then a CIGAR that is NA, "*", or
+             that cannot be parsed produces no range and an error code (see
+             _errmsg_as_errcode()) is recorded in the "errcode" attribute of
+             the returned object. If FALSE, then an error is raised.
 
-   Returns either a CompressedIRangesList object of the same length as 'cigars'
-   (if 'f' is NULL) or an ordinary list of IRanges objects with 1 list element
-   per level in 'f' (if 'f' is a factor). This list is then turned into a
-   SimpleIRangesList object in R. */
+   Returns a CompressedIRangesList object of the same length as 'cigars'
+   (if 'f' is NULL) or with 1 list element per level in 'f' (if 'f' is a
+   factor). In the latter case, the ranges are first collected in the order
+   of the CIGARs, then grouped by level with group_range_bufs_by_level(). */
 SEXP C_cigars_as_ranges(SEXP cigars, SEXP space,
 		SEXP flags, SEXP lmmpos, SEXP f,
 		SEXP ops, SEXP drop_empty_ranges, SEXP reduce_ranges,
-		SEXP with_ops, SEXP with_oplens)
+		SEXP with_ops, SEXP with_oplens, SEXP na_on_error)
 {
-	int cigar_len = LENGTH(cigars);
-	const int *flags_p;
+	CigarsHolder cigars_holder = _new_CigarsHolder(cigars);
+	R_xlen_t cigar_len = cigars_holder.length;
+	const int *flags_p = NULL;
 	if (flags != R_NilValue)
 		flags_p = INTEGER(flags);
 	_init_ops_lkup_table(ops);
 	int space0 = INTEGER(space)[0];
-	int lmmpos_len = LENGTH(lmmpos);
+	R_xlen_t lmmpos_len = XLENGTH(lmmpos);
 	const int *lmmpos_p = INTEGER(lmmpos);
 	int f_is_NULL = f == R_NilValue;
 
-	IntPairAE *range_buf1;
-	IntPairAEAE *range_buf2;
+	/* In both modes, the ranges are collected in the order of the CIGARs
+	   and 'cigar_ends[i]' is set to the number of ranges collected after
+	   processing 'cigars[i]'. If 'f' is NULL, these are the breakpoints of
+	   the returned CompressedIRangesList object. */
 	SEXP ans_breakpoints;
-	int *breakpoints;
-	SEXP f_levels;
-	const int *f_p;
+	int *cigar_ends;
+	SEXP f_levels = R_NilValue;
+	const int *f_p = NULL;
 	if (f_is_NULL) {
-		int ans_len = cigar_len;
-		/* We will typically generate at least 'cigar_len' ranges. */
-		range_buf1 = new_IntPairAE(ans_len, 0);
-		ans_breakpoints = PROTECT(NEW_INTEGER(ans_len));
-		breakpoints = INTEGER(ans_breakpoints);
+		/* The CompressedIRangesList object that we return cannot
+		   have more than INT_MAX list elements. */
+		if (cigar_len > INT_MAX)
+			_too_many_elements_error("the returned list");
+		ans_breakpoints = PROTECT(NEW_INTEGER(cigar_len));
+		cigar_ends = INTEGER(ans_breakpoints);
 	} else {
 		f_levels = GET_LEVELS(f);
-		int ans_len = LENGTH(f_levels);
-		range_buf2 = new_IntPairAEAE(ans_len, ans_len);
+		ans_breakpoints = PROTECT(NEW_INTEGER(LENGTH(f_levels)));
+		cigar_ends = (int *) R_alloc(cigar_len, sizeof(int));
 		f_p = INTEGER(f);
 	}
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, cigar_len));
+	int nprotect = 2;
 
+	/* We will typically generate at least 'cigar_len' ranges. */
+	IntPairAE *range_buf = new_IntPairAE(cigar_len, 0);
 	int drop_empty_ranges0 = LOGICAL(drop_empty_ranges)[0];
 	int reduce_ranges0 = LOGICAL(reduce_ranges)[0];
 	CharAEAE *OP_buf = NULL;
 	IntAE *OPL_buf1 = NULL;
 	IntAEAE *OPL_buf2 = NULL;
-	if (f_is_NULL) {
-		if (LOGICAL(with_ops)[0])
-			OP_buf = new_CharAEAE(cigar_len, 0);
-		if (LOGICAL(with_oplens)[0]) {
-			if (reduce_ranges0)
-				OPL_buf2 = new_IntAEAE(cigar_len, 0);
-			else
-				OPL_buf1 = new_IntAE(cigar_len, 0, 0);
-		}
+	if (LOGICAL(with_ops)[0])
+		OP_buf = new_CharAEAE(cigar_len, 0);
+	if (LOGICAL(with_oplens)[0]) {
+		if (reduce_ranges0)
+			OPL_buf2 = new_IntAEAE(cigar_len, 0);
+		else
+			OPL_buf1 = new_IntAE(cigar_len, 0, 0);
 	}
-	for (int i = 0; i < cigar_len; i++) {
+	for (R_xlen_t i = 0; i < cigar_len; i++) {
 		if (flags != R_NilValue) {
 			if (*flags_p == NA_INTEGER) {
-				if (f_is_NULL)
-					UNPROTECT(1);
+				UNPROTECT(nprotect);
 				error("'flags' contains NAs");
 			}
 			if (*flags_p & 0x004) {
@@ -304,54 +408,74 @@ SEXP C_cigars_as_ranges(SEXP cigars, SEXP space,
 				goto for_tail;
 			}
 		}
-		SEXP cigars_elt = STRING_ELT(cigars, i);
-		if (cigars_elt == NA_STRING) {
-			if (f_is_NULL)
-				UNPROTECT(1);
-			error("'cigars[%d]' is NA", i + 1);
+		Cigar cigar;
+		if (!_get_cigar(&cigars_holder, i, &cigar)) {
+			if (errcodes != R_NilValue) {
+				INTEGER(errcodes)[i] = CIGAR_IS_NA;
+				goto for_tail;
+			}
+			UNPROTECT(nprotect);
+			error("'cigars[%lld]' is NA", (long long) i + 1);
 		}
-		const char *cigar_string = CHAR(cigars_elt);
-		if (strcmp(cigar_string, "*") == 0) {
-			if (f_is_NULL)
-				UNPROTECT(1);
-			error("'cigars[%d]' is \"*\"", i + 1);
+		if (_cigar_is_star(&cigar)) {
+			if (errcodes != R_NilValue) {
+				INTEGER(errcodes)[i] = CIGAR_IS_NA;
+				goto for_tail;
+			}
+			UNPROTECT(nprotect);
+			error("'cigars[%lld]' is \"*\"", (long long) i + 1);
 		}
 		if (*lmmpos_p == NA_INTEGER || *lmmpos_p == 0) {
-			if (f_is_NULL)
-				UNPROTECT(1);
-			error("'lmmpos[%d]' is NA or 0", i + 1);
+			UNPROTECT(nprotect);
+			error("'lmmpos[%lld]' is NA or 0",
+			      (long long) i + 1);
 		}
 		if (!f_is_NULL) {
-			if (*f_p == NA_INTEGER)
-				error("'f[%d]' is NA", i + 1);
-			range_buf1 = range_buf2->elts[*f_p - 1];
+			if (f_p[i] == NA_INTEGER) {
+				UNPROTECT(nprotect);
+				error("'f[%lld]' is NA", (long long) i + 1);
+			}
 		}
+		int nelt0 = IntPairAE_get_nelt(range_buf);
 		const char *errmsg = parse_cigar_ranges(
-					cigar_string, space0, *lmmpos_p,
+					&cigar, space0, *lmmpos_p,
 					drop_empty_ranges0, reduce_ranges0,
-					range_buf1, OP_buf, OPL_buf1, OPL_buf2);
+					range_buf, OP_buf, OPL_buf1, OPL_buf2);
 		if (errmsg != NULL) {
-			if (f_is_NULL)
-				UNPROTECT(1);
-			error("in 'cigars[%d]': %s", i + 1, errmsg);
+			if (errcodes == R_NilValue) {
+				UNPROTECT(nprotect);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			truncate_range_bufs(nelt0, range_buf,
+					    OP_buf, OPL_buf1, OPL_buf2);
+			INTEGER(errcodes)[i] = _errmsg_as_errcode(errmsg);
+		}
+		/* The breakpoints of a CompressedIRangesList object, and the
+		   length of an IRanges object, must fit in an int. */
+		if (IntPairAE_get_nelt(range_buf) > INT_MAX) {
+			UNPROTECT(nprotect);
+			_too_many_elements_error("the returned ranges");
 		}
 for_tail:
 		if (flags != R_NilValue)
 			flags_p++;
 		if (lmmpos_len != 1)
 			lmmpos_p++;
-		if (f_is_NULL) {
-			*(breakpoints++) = IntPairAE_get_nelt(range_buf1);
-		} else {
-			f_p++;
-		}
+		cigar_ends[i] = IntPairAE_get_nelt(range_buf);
 	}
 	if (!f_is_NULL)
-		return make_list_of_IRanges(range_buf2, f_levels);
-	SEXP ans =
-		PROTECT(make_CompressedIRangesList(range_buf1, ans_breakpoints,
-						   OP_buf, OPL_buf1, OPL_buf2));
-	UNPROTECT(2);
+		group_range_bufs_by_level(cigar_len, cigar_ends,
+					  f_p, LENGTH(f_levels),
+					  INTEGER(ans_breakpoints),
+					  &range_buf,
+					  &OP_buf, &OPL_buf1, &OPL_buf2);
+	SEXP ans = PROTECT(make_CompressedIRangesList(range_buf,
+					ans_breakpoints,
+					OP_buf, OPL_buf1, OPL_buf2,
+					f_is_NULL ? NULL : f_levels));
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(nprotect + 1);
 	return ans;
 }
 
@@ -3,6 +3,8 @@
 
 #include <Rdefines.h>
 
+#include "cigar_core.h"
+
 SEXP C_cigars_as_ranges(
 	SEXP cigars,
 	SEXP space,
@@ -13,7 +15,8 @@ SEXP C_cigars_as_ranges(
 	SEXP drop_empty_ranges,
 	SEXP reduce_ranges,
 	SEXP with_ops,
-	SEXP with_oplens
+	SEXP with_oplens,
+	SEXP na_on_error
 );
 
 #endif  /* _CIGARS_AS_RANGES_H_ */
@@ -2,84 +2,95 @@
 
 #include "S4Vectors_interface.h"
 
-#include <ctype.h> /* for isdigit() */
+#include <string.h> /* for memset() */
+#include <limits.h> /* for INT_MAX */
 
 
-static char errmsg_buf[200];
+/****************************************************************************
+ * Error reporting
+ */
 
-const char *_get_cigar_parsing_error()
+/* Map an error message returned by one of the CIGAR kernels to one of the
+   CIGAR_* error codes defined in explode_cigars.h. The messages are
+   recognized by the buffer (or constant string) that holds them, so every
+   message that a kernel can return under 'na_on_error' must be listed here.
+   An unknown message is a bug in cigarillo, not a problem with the CIGAR. */
+int _errmsg_as_errcode(const char *errmsg)
 {
-	return errmsg_buf;
+	if (errmsg == _get_cigar_parsing_error())
+		return CIGAR_PARSE_ERROR;
+	if (errmsg == _get_unknown_cigar_op_error())
+		return CIGAR_UNKNOWN_OP;
+	if (errmsg == _empty_cigar_error() ||
+	    errmsg == _empty_after_trimming_error() ||
+	    errmsg == _empty_after_softclipping_error())
+		return CIGAR_IS_EMPTY;
+	error("cigarillo internal error in _errmsg_as_errcode(): "
+	      "unexpected error message \"%s\"", errmsg);
+	return 0;  /* gcc -Wall */
 }
 
-/* Return the number of chars that was read, or 0 if there is no more char
-   to read (i.e. cigar_string[offset] is '\0'), or -1 in case of a parse error
-   (in which case _get_cigar_parsing_error() can be used to get a pointer to
-   the error message).
-   Zero-length operations are ignored. */
-int _next_cigar_OP(const char *cigar_string, int offset, char *OP, int *OPL)
+/* Returns R_NilValue if 'na_on_error' is FALSE (in which case the .Call entry
+   point is expected to raise an error on the first invalid CIGAR), or an
+   integer vector of length 'n' filled with zeros. Either way the result
+   must be PROTECT'ed. */
+SEXP _new_errcodes(SEXP na_on_error, R_xlen_t n)
 {
-	char c;
-	int offset0, opl;
-
-	if (!cigar_string[offset])
-		return 0;
-	offset0 = offset;
-	do {
-		/* Extract *OPL */
-		opl = 0;
-		while (isdigit(c = cigar_string[offset])) {
-			offset++;
-			opl *= 10;
-			opl += c - '0';
-		}
-		/* Extract *OP */
-		if (!(*OP = cigar_string[offset])) {
-			snprintf(errmsg_buf, sizeof(errmsg_buf),
-				 "unexpected CIGAR end after char %d",
-				 offset);
-			return -1;
-		}
-		offset++;
-	} while (opl == 0);
-	*OPL = opl;
-	return offset - offset0;
+	if (!LOGICAL(na_on_error)[0])
+		return R_NilValue;
+	SEXP errcodes = NEW_INTEGER(n);
+	memset(INTEGER(errcodes), 0, n * sizeof(int));
+	return errcodes;
+}
+
+/* The R wrapper turns the "errcode" attribute into an "errors" factor. */
+void _set_errcodes_attrib(SEXP x, SEXP errcodes)
+{
+	if (errcodes != R_NilValue)
+		setAttrib(x, install("errcode"), errcodes);
+	return;
 }
 
-/* Return the number of chars that was read, or 0 if there is no more char
-   to read (i.e. offset is 0), or -1 in case of a parse error.
+/* Some of the objects returned to R (matrices, CompressedList objects)
+   cannot have more than INT_MAX rows or list elements. The CIGAR strings
+   need to be processed by chunks in that case. */
+void _too_many_elements_error(const char *what)
+{
+	error("%s would have more than %d elements, which is not supported. "
+	      "Please use reduce_cigar_chunks() to process the CIGAR strings "
+	      "by chunks.", what, INT_MAX);
+}
+
+
+/****************************************************************************
+ * _tokenize_cigar()
+ */
+
+/* Split 'cigar_string' into its CIGAR operations (stored in 'OP_buf') and
+   their lengths (stored in 'OPL_buf'). Both buffers are emptied first.
+   Unlike split_cigar_string() below, all the operations are kept.
    Zero-length operations are ignored. */
-int _prev_cigar_OP(const char *cigar_string, int offset, char *OP, int *OPL)
+const char *_tokenize_cigar(const char *cigar_string,
+		CharAE *OP_buf, IntAE *OPL_buf)
 {
-	char c;
-	int offset0, opl, powof10;
-
-	if (offset == 0)
-		return 0;
-	offset0 = offset;
-	do {
-		/* Extract *OP */
-		offset--;
-		*OP = cigar_string[offset];
-		/* Extract *OPL */
-		if (offset == 0) {
-			snprintf(errmsg_buf, sizeof(errmsg_buf),
-				 "no CIGAR operation length before char %d",
-				 offset + 1);
-			return -1;
-		}
-		offset--;
-		opl = 0;
-		powof10 = 1;
-		while (offset >= 0 && isdigit(c = cigar_string[offset])) {
-			opl += (c - '0') * powof10;
-			powof10 *= 10;
-			offset--;
-		}
-		offset++;
-	} while (opl == 0);
-	*OPL = opl;
-	return offset0 - offset;
+	int offset, n, OPL /* Operation Length */;
+	char OP /* Operation */;
+
+	CharAE_set_nelt(OP_buf, 0);
+	IntAE_set_nelt(OPL_buf, 0);
+	offset = 0;
+	while ((n = _next_cigar_OP(cigar_string, offset, &OP, &OPL))) {
+		if (n == -1)
+			return _get_cigar_parsing_error();
+		const char *OP_elts0 = OP_buf->elts;
+		const int *OPL_elts0 = OPL_buf->elts;
+		CharAE_insert_at(OP_buf, CharAE_get_nelt(OP_buf), OP);
+		IntAE_insert_at(OPL_buf, IntAE_get_nelt(OPL_buf), OPL);
+		STATS_COUNT_GROWTH(OP_elts0, OP_buf->elts);
+		STATS_COUNT_GROWTH(OPL_elts0, OPL_buf->elts);
+		offset += n;
+	}
+	return NULL;
 }
 
 
@@ -147,11 +158,12 @@ static const char *parse_cigar(const char *cigar_string)
 SEXP C_validate_cigars(SEXP cigars, SEXP ans_type)
 {
 	SEXP ans;
-	int ncigars, ans_type0, i;
+	R_xlen_t ncigars, i;
+	int ans_type0;
 	const char *cigar_string, *errmsg;
 	char string_buf[200];
 
-	ncigars = LENGTH(cigars);
+	ncigars = XLENGTH(cigars);
 	ans_type0 = INTEGER(ans_type)[0];
 	if (ans_type0 == 1)
 		PROTECT(ans = NEW_LOGICAL(ncigars));
@@ -177,7 +189,8 @@ SEXP C_validate_cigars(SEXP cigars, SEXP ans_type)
 		}
 		if (errmsg != NULL) {
 			snprintf(string_buf, sizeof(string_buf),
-				 "element %d is invalid (%s)", i + 1, errmsg);
+				 "element %lld is invalid (%s)",
+				 (long long) i + 1, errmsg);
 			return mkString(string_buf);
 		}
 	}
@@ -203,12 +216,18 @@ static const char *split_cigar_string(const char *cigar_string,
 		if (n == -1)
 			return _get_cigar_parsing_error();
 		if (_is_in_ops(OP)) {
-			if (OPbuf != NULL)
+			if (OPbuf != NULL) {
+				const char *elts0 = OPbuf->elts;
 				CharAE_insert_at(OPbuf,
 					CharAE_get_nelt(OPbuf), OP);
-			if (OPLbuf != NULL)
+				STATS_COUNT_GROWTH(elts0, OPbuf->elts);
+			}
+			if (OPLbuf != NULL) {
+				const int *elts0 = OPLbuf->elts;
 				IntAE_insert_at(OPLbuf,
 					IntAE_get_nelt(OPLbuf), OPL);
+				STATS_COUNT_GROWTH(elts0, OPLbuf->elts);
+			}
 		}
 		offset += n;
 	}
@@ -224,6 +243,11 @@ static const char *split_cigar_string(const char *cigar_string,
  *   ops:    NULL or a character vector containing the CIGAR operations to
  *           actually consider. If NULL, then all CIGAR operations are
  *           considered.
+ *   na_on_error: TRUE or FALSE. If TRUE, then a CIGAR that is NA, "*", or
+ *           that cannot be parsed produces a zero-length list element
+ *           and an error code (see _errmsg_as_errcode()) is recorded in
+ *           the "errcode" attribute of the returned list. If FALSE, then
+ *           an error is raised.
  * Both functions return a list of the same length as 'cigars' where each
  * list element is a character vector (for C_explode_cigar_ops()) or an integer
  * vector (for C_explode_cigar_oplens()). The 2 lists have the same shape,
@@ -234,81 +258,91 @@ static const char *split_cigar_string(const char *cigar_string,
  * CIGAR operation lengths. Zero-length operations or operations not listed
  * in 'ops' are ignored.
  */
-SEXP C_explode_cigar_ops(SEXP cigars, SEXP ops)
+
+/* Returns NULL on success, or an error message. In the latter case, the
+   error code is stored in '*errcode'. */
+static const char *explode_cigar(SEXP cigars, R_xlen_t i,
+		CharAE *OPbuf, IntAE *OPLbuf, int *errcode)
 {
-	SEXP ans, ans_elt, ans_elt_elt;
-	int ncigars, ans_elt_len, i, j;
-	CharAE *OPbuf;
-	const char *cigar_string, *errmsg;
+	SEXP cigars_elt = STRING_ELT(cigars, i);
+	if (cigars_elt == NA_STRING) {
+		*errcode = CIGAR_IS_NA;
+		return "CIGAR string is NA";
+	}
+	const char *cigar_string = CHAR(cigars_elt);
+	if (strcmp(cigar_string, "*") == 0) {
+		*errcode = CIGAR_IS_NA;
+		return "CIGAR string is \"*\"";
+	}
+	const char *errmsg = split_cigar_string(cigar_string, OPbuf, OPLbuf);
+	if (errmsg != NULL)
+		*errcode = _errmsg_as_errcode(errmsg);
+	return errmsg;
+}
 
-	ncigars = LENGTH(cigars);
+SEXP C_explode_cigar_ops(SEXP cigars, SEXP ops, SEXP na_on_error)
+{
+	R_xlen_t ncigars = XLENGTH(cigars);
 	_init_ops_lkup_table(ops);
-	PROTECT(ans = NEW_LIST(ncigars));
-	OPbuf = new_CharAE(0);
-	for (i = 0; i < ncigars; i++) {
-		SEXP cigars_elt = STRING_ELT(cigars, i);
-		if (cigars_elt == NA_STRING) {
-			UNPROTECT(1);
-			error("'cigars[%d]' is NA", i + 1);
-		}
-		cigar_string = CHAR(cigars_elt);
-		if (strcmp(cigar_string, "*") == 0) {
-			UNPROTECT(1);
-			error("'cigars[%d]' is \"*\"", i + 1);
-		}
+	SEXP ans = PROTECT(NEW_LIST(ncigars));
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, ncigars));
+	CharAE *OPbuf = new_CharAE(0);
+	for (R_xlen_t i = 0; i < ncigars; i++) {
 		CharAE_set_nelt(OPbuf, 0);
-		errmsg = split_cigar_string(cigar_string, OPbuf, NULL);
+		int errcode;
+		const char *errmsg = explode_cigar(cigars, i, OPbuf, NULL,
+						   &errcode);
 		if (errmsg != NULL) {
-			UNPROTECT(1);
-			error("in 'cigars[%d]': %s", i + 1, errmsg);
+			if (errcodes == R_NilValue) {
+				UNPROTECT(2);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			INTEGER(errcodes)[i] = errcode;
+			CharAE_set_nelt(OPbuf, 0);
 		}
-		ans_elt_len = CharAE_get_nelt(OPbuf);
-		PROTECT(ans_elt = NEW_CHARACTER(ans_elt_len));
-		for (j = 0; j < ans_elt_len; j++) {
-			PROTECT(ans_elt_elt = mkCharLen(OPbuf->elts + j, 1));
+		int ans_elt_len = CharAE_get_nelt(OPbuf);
+		SEXP ans_elt = PROTECT(NEW_CHARACTER(ans_elt_len));
+		for (int j = 0; j < ans_elt_len; j++) {
+			SEXP ans_elt_elt = PROTECT(mkCharLen(OPbuf->elts + j, 1));
 			SET_STRING_ELT(ans_elt, j, ans_elt_elt);
 			UNPROTECT(1);
 		}
 		SET_VECTOR_ELT(ans, i, ans_elt);
 		UNPROTECT(1);
 	}
-	UNPROTECT(1);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(2);
 	return ans;
 }
 
-SEXP C_explode_cigar_oplens(SEXP cigars, SEXP ops)
+SEXP C_explode_cigar_oplens(SEXP cigars, SEXP ops, SEXP na_on_error)
 {
-	SEXP ans, ans_elt;
-	int ncigars, i;
-	IntAE *OPLbuf;
-	const char *cigar_string, *errmsg;
-
-	ncigars = LENGTH(cigars);
+	R_xlen_t ncigars = XLENGTH(cigars);
 	_init_ops_lkup_table(ops);
-	PROTECT(ans = NEW_LIST(ncigars));
-	OPLbuf = new_IntAE(0, 0, 0);
-	for (i = 0; i < ncigars; i++) {
-		SEXP cigars_elt = STRING_ELT(cigars, i);
-		if (cigars_elt == NA_STRING) {
-			UNPROTECT(1);
-			error("'cigars[%d]' is NA", i + 1);
-		}
-		cigar_string = CHAR(cigars_elt);
-		if (strcmp(cigar_string, "*") == 0) {
-			UNPROTECT(1);
-			error("'cigars[%d]' is \"*\"", i + 1);
-		}
+	SEXP ans = PROTECT(NEW_LIST(ncigars));
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, ncigars));
+	IntAE *OPLbuf = new_IntAE(0, 0, 0);
+	for (R_xlen_t i = 0; i < ncigars; i++) {
 		IntAE_set_nelt(OPLbuf, 0);
-		errmsg = split_cigar_string(cigar_string, NULL, OPLbuf);
+		int errcode;
+		const char *errmsg = explode_cigar(cigars, i, NULL, OPLbuf,
+						   &errcode);
 		if (errmsg != NULL) {
-			UNPROTECT(1);
-			error("in 'cigars[%d]': %s", i + 1, errmsg);
+			if (errcodes == R_NilValue) {
+				UNPROTECT(2);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			INTEGER(errcodes)[i] = errcode;
+			IntAE_set_nelt(OPLbuf, 0);
 		}
-		PROTECT(ans_elt = new_INTEGER_from_IntAE(OPLbuf));
+		SEXP ans_elt = PROTECT(new_INTEGER_from_IntAE(OPLbuf));
 		SET_VECTOR_ELT(ans, i, ans_elt);
 		UNPROTECT(1);
 	}
-	UNPROTECT(1);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(2);
 	return ans;
 }
 
@@ -3,20 +3,36 @@
 
 #include <Rdefines.h>
 
-const char *_get_cigar_parsing_error();
+#include "S4Vectors_interface.h"
 
-int _next_cigar_OP(
-	const char *cigar_string,
-	int offset,
-	char *OP,
-	int *OPL
+#include "cigar_core.h"
+
+/* Error codes reported by the .Call entry points when 'na_on_error' is
+   TRUE. 0 means no error. */
+#define CIGAR_IS_NA        1
+#define CIGAR_PARSE_ERROR  2
+#define CIGAR_UNKNOWN_OP   3
+#define CIGAR_IS_EMPTY     4
+#define CIGAR_NO_GOOD_BASES 5  /* trim_alignments_by_quality() only */
+
+int _errmsg_as_errcode(const char *errmsg);
+
+SEXP _new_errcodes(
+	SEXP na_on_error,
+	R_xlen_t n
 );
 
-int _prev_cigar_OP(
+void _set_errcodes_attrib(
+	SEXP x,
+	SEXP errcodes
+);
+
+void _too_many_elements_error(const char *what);
+
+const char *_tokenize_cigar(
 	const char *cigar_string,
-	int offset,
-	char *OP,
-	int *OPL
+	CharAE *OP_buf,
+	IntAE *OPL_buf
 );
 
 void _init_ops_lkup_table(SEXP ops);
@@ -30,12 +46,14 @@ SEXP C_validate_cigars(
 
 SEXP C_explode_cigar_ops(
 	SEXP cigars,
-	SEXP ops
+	SEXP ops,
+	SEXP na_on_error
 );
 
 SEXP C_explode_cigar_oplens(
 	SEXP cigars,
-	SEXP ops
+	SEXP ops,
+	SEXP na_on_error
 );
 
 #endif  /* _EXPLODE_CIGARS_H_ */
@@ -0,0 +1,247 @@
+#include "implode_cigars.h"
+
+#include "cigar_core.h"
+
+#include <string.h>  /* for strchr() */
+
+
+/****************************************************************************
+ * _append_cigar_OP()
+ */
+
+/* "00", "01", "02", ..., "99" */
+static const char digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/* Format 'x' right-aligned in 'buf_end[-ndigit ... -1]' and return 'ndigit'.
+   We format 2 digits at a time using the 'digit_pairs' lookup table, which
+   is much faster than going thru snprintf(). */
+static int format_uint(unsigned int x, char *buf_end)
+{
+	char *p = buf_end;
+	while (x >= 100) {
+		const char *pair = digit_pairs + 2 * (x % 100);
+		x /= 100;
+		*(--p) = pair[1];
+		*(--p) = pair[0];
+	}
+	if (x >= 10) {
+		const char *pair = digit_pairs + 2 * x;
+		*(--p) = pair[1];
+		*(--p) = pair[0];
+	} else {
+		*(--p) = '0' + x;
+	}
+	return buf_end - p;
+}
+
+/* Append the "<OPL><OP>" token to 'cigar_buf'. The buffer is grown as needed
+   by CharAE_insert_at() so there is no limit on the length of the CIGAR
+   string that we can write.
+   Note that 'cigar_buf' is NOT nul-terminated. */
+void _append_cigar_OP(CharAE *cigar_buf, char OP, int OPL)
+{
+	char tmp[11];  /* UINT_MAX has 10 digits, + 1 for OP */
+	tmp[sizeof(tmp) - 1] = OP;
+	int ntoken = format_uint((unsigned int) OPL,
+				 tmp + sizeof(tmp) - 1) + 1;
+	const char *elts0 = cigar_buf->elts;
+	size_t nelt = CharAE_get_nelt(cigar_buf);
+	for (int j = sizeof(tmp) - ntoken; j < (int) sizeof(tmp); j++)
+		CharAE_insert_at(cigar_buf, nelt++, tmp[j]);
+	STATS_COUNT_GROWTH(elts0, cigar_buf->elts);
+	return;
+}
+
+
+/****************************************************************************
+ * C_implode_cigars()
+ */
+
+static const char *get_OP(SEXP ops, int j, char *OP)
+{
+	static const char *allOPs = "MIDNSHP=X";
+
+	SEXP ops_elt = STRING_ELT(ops, j);
+	if (ops_elt == NA_STRING)
+		return "is NA";
+	if (LENGTH(ops_elt) != 1)
+		return "is not a single letter";
+	*OP = CHAR(ops_elt)[0];
+	if (strchr(allOPs, (int) *OP) == NULL)
+		return "is not a valid CIGAR operation";
+	return NULL;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   ops:    character vector of single-letter CIGAR operations (typically
+ *           obtained by unlisting the output of C_explode_cigar_ops()).
+ *   oplens: integer vector parallel to 'ops' containing the operation
+ *           lengths.
+ *   breakpoints: integer vector containing the end of each CIGAR string
+ *           along 'ops' and 'oplens' (i.e. the "end" of the partitioning).
+ *   merge_ops: TRUE or FALSE. Should adjacent identical operations be merged?
+ *   drop_empty_ops: TRUE or FALSE. Should zero-length operations be dropped?
+ * Returns a character vector of the same length as 'breakpoints' containing
+ * the CIGAR strings.
+ */
+SEXP C_implode_cigars(SEXP ops, SEXP oplens, SEXP breakpoints,
+		SEXP merge_ops, SEXP drop_empty_ops)
+{
+	int ncigars = LENGTH(breakpoints);
+	const int *oplens_p = INTEGER(oplens);
+	const int *breakpoints_p = INTEGER(breakpoints);
+	int merge_ops0 = LOGICAL(merge_ops)[0];
+	int drop_empty_ops0 = LOGICAL(drop_empty_ops)[0];
+	CharAE *cigar_buf = new_CharAE(0);
+	SEXP ans = PROTECT(NEW_CHARACTER(ncigars));
+	int j = 0;
+	for (int i = 0; i < ncigars; i++) {
+		CharAE_set_nelt(cigar_buf, 0);
+		char prev_OP = 0;
+		int prev_OPL = 0;
+		for ( ; j < breakpoints_p[i]; j++) {
+			char OP;
+			const char *errmsg = get_OP(ops, j, &OP);
+			if (errmsg != NULL) {
+				UNPROTECT(1);
+				error("'ops[%d]' %s", j + 1, errmsg);
+			}
+			int OPL = oplens_p[j];
+			if (OPL == NA_INTEGER || OPL < 0) {
+				UNPROTECT(1);
+				error("'oplens[%d]' is NA or negative", j + 1);
+			}
+			if (drop_empty_ops0 && OPL == 0)
+				continue;
+			if (merge_ops0 && OP == prev_OP) {
+				if (OPL > INT_MAX - prev_OPL) {
+					UNPROTECT(1);
+					error("in CIGAR %d: merging operations "
+					      "results in an integer overflow",
+					      i + 1);
+				}
+				prev_OPL += OPL;
+				continue;
+			}
+			if (prev_OP != 0)
+				_append_cigar_OP(cigar_buf, prev_OP, prev_OPL);
+			prev_OP = OP;
+			prev_OPL = OPL;
+		}
+		if (prev_OP != 0)
+			_append_cigar_OP(cigar_buf, prev_OP, prev_OPL);
+		SEXP ans_elt = PROTECT(mkCharLen(cigar_buf->elts,
+					CharAE_get_nelt(cigar_buf)));
+		SET_STRING_ELT(ans, i, ans_elt);
+		UNPROTECT(1);
+	}
+	UNPROTECT(1);
+	return ans;
+}
+
+
+/****************************************************************************
+ * C_decode_cigar_words()
+ */
+
+/* BAM encodes a CIGAR operation as a uint32 word: the operation length in
+   the 28 high bits and the index of the operation in "MIDNSHP=X" in the
+   4 low bits. The CIGARs with more than 65535 operations are stored in
+   the CG:B,I tag of the BAM record using the same encoding. */
+static const char *append_cigar_word(CharAE *cigar_buf, unsigned int word)
+{
+	static const char *bamOPs = "MIDNSHP=X";
+	static char errmsg_buf[200];
+
+	unsigned int OPcode = word & 0xf;
+	if (OPcode >= 9) {
+		snprintf(errmsg_buf, sizeof(errmsg_buf),
+			 "invalid CIGAR operation code %u", OPcode);
+		return errmsg_buf;
+	}
+	_append_cigar_OP(cigar_buf, bamOPs[OPcode], (int) (word >> 4));
+	return NULL;
+}
+
+/* Returns NULL on success, or an error message. */
+static const char *decode_words(SEXP words_elt, CharAE *cigar_buf)
+{
+	R_xlen_t nwords = XLENGTH(words_elt);
+	const char *errmsg;
+	CharAE_set_nelt(cigar_buf, 0);
+	if (TYPEOF(words_elt) == INTSXP) {
+		/* Words with an operation length >= 2^27 are negative when
+		   stored in an R integer vector. We just need to read them
+		   back as unsigned ints. */
+		const int *words_p = INTEGER(words_elt);
+		for (R_xlen_t k = 0; k < nwords; k++) {
+			errmsg = append_cigar_word(cigar_buf,
+						   (unsigned int) words_p[k]);
+			if (errmsg != NULL)
+				return errmsg;
+		}
+		return NULL;
+	}
+	if (TYPEOF(words_elt) == REALSXP) {
+		const double *words_p = REAL(words_elt);
+		for (R_xlen_t k = 0; k < nwords; k++) {
+			double word = words_p[k];
+			if (ISNAN(word) || word < 0 || word > 4294967295.0 ||
+			    word != (double) (unsigned int) word)
+				return "CIGAR words must be NA-free "
+				       "unsigned 32-bit integers";
+			errmsg = append_cigar_word(cigar_buf,
+						   (unsigned int) word);
+			if (errmsg != NULL)
+				return errmsg;
+		}
+		return NULL;
+	}
+	return "CIGAR words must be stored in an integer or double vector";
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   words: list where each list element is NULL, or an integer or double
+ *          vector containing the BAM-encoded CIGAR words of an alignment
+ *          (e.g. the content of its CG:B,I tag).
+ * Returns a character vector of the same length as 'words' containing the
+ * CIGAR strings. A NULL or zero-length list element produces an NA.
+ */
+SEXP C_decode_cigar_words(SEXP words)
+{
+	R_xlen_t ncigars = XLENGTH(words);
+	CharAE *cigar_buf = new_CharAE(0);
+	SEXP ans = PROTECT(NEW_CHARACTER(ncigars));
+	for (R_xlen_t i = 0; i < ncigars; i++) {
+		SEXP words_elt = VECTOR_ELT(words, i);
+		if (words_elt == R_NilValue || XLENGTH(words_elt) == 0) {
+			SET_STRING_ELT(ans, i, NA_STRING);
+			continue;
+		}
+		const char *errmsg = decode_words(words_elt, cigar_buf);
+		if (errmsg != NULL) {
+			UNPROTECT(1);
+			error("in 'words[[%lld]]': %s",
+			      (long long) i + 1, errmsg);
+		}
+		SEXP ans_elt = PROTECT(mkCharLen(cigar_buf->elts,
+					CharAE_get_nelt(cigar_buf)));
+		SET_STRING_ELT(ans, i, ans_elt);
+		UNPROTECT(1);
+	}
+	UNPROTECT(1);
+	return ans;
+}
+
@@ -0,0 +1,25 @@
+#ifndef _IMPLODE_CIGARS_H_
+#define _IMPLODE_CIGARS_H_
+
+#include <Rdefines.h>
+
+#include "S4Vectors_interface.h"
+
+void _append_cigar_OP(
+	CharAE *cigar_buf,
+	char OP,
+	int OPL
+);
+
+SEXP C_implode_cigars(
+	SEXP ops,
+	SEXP oplens,
+	SEXP breakpoints,
+	SEXP merge_ops,
+	SEXP drop_empty_ops
+);
+
+SEXP C_decode_cigar_words(SEXP words);
+
+#endif  /* _IMPLODE_CIGARS_H_ */
+
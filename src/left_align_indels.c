@@ -0,0 +1,292 @@
+#include "left_align_indels.h"
+
+#include "S4Vectors_interface.h"
+
+#include "cigar_ops_visibility.h"
+#include "explode_cigars.h"
+#include "implode_cigars.h"
+
+#include <ctype.h>   /* for toupper() */
+#include <stdio.h>   /* for snprintf() */
+
+
+static char errmsg_buf[200];
+
+static int is_alignment_OP(char OP)
+{
+	return OP == 'M' || OP == '=' || OP == 'X';
+}
+
+/* A read or reference sequence. Positions are 1-based. */
+typedef struct seq_t {
+	const char *letters;
+	int length;
+} Seq;
+
+/* Positions outside of the sequence are never equal to anything. */
+static int same_letters(const Seq *seq, long long pos1, long long pos2)
+{
+	if (pos1 < 1 || pos1 > seq->length || pos2 < 1 || pos2 > seq->length)
+		return 0;
+	return toupper((unsigned char) seq->letters[pos1 - 1]) ==
+	       toupper((unsigned char) seq->letters[pos2 - 1]);
+}
+
+/* Number of positions by which the indel of length 'OPL' that starts at
+   position 'pos' on 'seq' (the reference for a deletion, the read for an
+   insertion) can be shifted to the left without changing the alignment.
+   The indel can be shifted by 1 position as long as the letter that
+   precedes it is the same as its last letter. */
+static int max_left_shift(const Seq *seq, long long pos, int OPL,
+		int max_shift)
+{
+	int shift = 0;
+	while (shift < max_shift &&
+	       same_letters(seq, pos - 1 - shift, pos + OPL - 1 - shift))
+		shift++;
+	return shift;
+}
+
+
+/****************************************************************************
+ * Left-aligning the indels of a CIGAR
+ *
+ * The tokens of the CIGAR are walked from left to right and copied to
+ * 'out_OPs' and 'out_OPLs'. A shifted indel takes the last 'shift'
+ * positions of the alignment operation (M, =, or X) that precedes it. These
+ * positions are put back on the other side of the indel i.e. they are added
+ * to the operation that follows the indel if it's of the same type, or
+ * inserted as a new operation otherwise. Shifting an indel by 1 position
+ * moves the last base of the preceding operation to the other side of the
+ * indel where it gets paired with the same letter, so an = (or X) operation
+ * stays an = (or X) operation.
+ * The indels are shifted in order so an indel is never shifted past
+ * another indel. The alignment operation that precedes an indel always
+ * keeps at least 1 position so the leftmost mapping position of the
+ * alignment doesn't change.
+ */
+
+typedef struct aligner_t {
+	CharAE *out_OPs;
+	IntAE *out_OPLs;
+	long long ref_pos, query_pos;  /* of the next op */
+} Aligner;
+
+static void emit_OP(Aligner *aligner, char OP, int OPL)
+{
+	size_t nout = CharAE_get_nelt(aligner->out_OPs);
+	CharAE_insert_at(aligner->out_OPs, nout, OP);
+	IntAE_insert_at(aligner->out_OPLs, nout, OPL);
+	if (_op_is_visible(OP, REFERENCE))
+		aligner->ref_pos += OPL;
+	if (_op_is_visible(OP, QUERY))
+		aligner->query_pos += OPL;
+	return;
+}
+
+/* 'read' is NULL if the read sequence is not available, in which case the
+   insertions are not shifted. Returns the number of indels that were
+   shifted. */
+static int left_align_tokens(Aligner *aligner,
+		const char *OPs, const int *OPLs, int nops, int lmmpos,
+		const Seq *read, const Seq *ref)
+{
+	char pending_OP = 0;
+	int pending_OPL = 0, nshifted = 0;
+
+	CharAE_set_nelt(aligner->out_OPs, 0);
+	IntAE_set_nelt(aligner->out_OPLs, 0);
+	aligner->ref_pos = lmmpos;
+	aligner->query_pos = 1;
+	for (int k = 0; k < nops; k++) {
+		char OP = OPs[k];
+		int OPL = OPLs[k];
+		if (pending_OPL != 0) {
+			if (OP == pending_OP) {
+				OPL += pending_OPL;
+			} else {
+				emit_OP(aligner, pending_OP, pending_OPL);
+			}
+			pending_OPL = 0;
+		}
+		size_t nout = CharAE_get_nelt(aligner->out_OPs);
+		if ((OP == 'D' || (OP == 'I' && read != NULL)) && nout != 0 &&
+		    is_alignment_OP(aligner->out_OPs->elts[nout - 1]))
+		{
+			int *prev_OPL = aligner->out_OPLs->elts + nout - 1;
+			int shift = OP == 'D' ?
+				max_left_shift(ref, aligner->ref_pos, OPL,
+					       *prev_OPL - 1) :
+				max_left_shift(read, aligner->query_pos, OPL,
+					       *prev_OPL - 1);
+			if (shift != 0) {
+				*prev_OPL -= shift;
+				aligner->ref_pos -= shift;
+				aligner->query_pos -= shift;
+				pending_OP = aligner->out_OPs->elts[nout - 1];
+				pending_OPL = shift;
+				nshifted++;
+			}
+		}
+		emit_OP(aligner, OP, OPL);
+	}
+	if (pending_OPL != 0)
+		emit_OP(aligner, pending_OP, pending_OPL);
+	return nshifted;
+}
+
+
+/****************************************************************************
+ * C_left_align_indels()
+ */
+
+static void get_seq(SEXP seqs, R_xlen_t i, Seq *seq)
+{
+	SEXP seq_elt = STRING_ELT(seqs, i);
+	if (seq_elt == NA_STRING ||
+	    (LENGTH(seq_elt) == 1 && CHAR(seq_elt)[0] == '*'))
+	{
+		seq->letters = NULL;
+		seq->length = 0;
+		return;
+	}
+	seq->letters = CHAR(seq_elt);
+	seq->length = LENGTH(seq_elt);
+	return;
+}
+
+/* Returns NULL on success, or an error message. Sets '*nshifted' to the
+   number of indels that were shifted, in which case the new CIGAR is
+   written to 'cigar_buf'. */
+static const char *left_align_cigar(const char *cigar_string, int lmmpos,
+		const Seq *read, const Seq *ref,
+		CharAE *OP_buf, IntAE *OPL_buf, Aligner *aligner,
+		CharAE *cigar_buf, int *nshifted)
+{
+	const char *errmsg = _tokenize_cigar(cigar_string, OP_buf, OPL_buf);
+	if (errmsg != NULL)
+		return errmsg;
+	int nops = IntAE_get_nelt(OPL_buf);
+	if (read != NULL) {
+		long long qwidth = _tokens_extent(OP_buf->elts, OPL_buf->elts,
+						  nops, QUERY);
+		if (qwidth != read->length) {
+			snprintf(errmsg_buf, sizeof(errmsg_buf),
+				 "the length of the read sequence (%d) is not "
+				 "the query extent of the CIGAR (%lld)",
+				 read->length, qwidth);
+			return errmsg_buf;
+		}
+	}
+	*nshifted = left_align_tokens(aligner, OP_buf->elts, OPL_buf->elts,
+				      nops, lmmpos, read, ref);
+	if (*nshifted == 0)
+		return NULL;
+	CharAE_set_nelt(cigar_buf, 0);
+	int nout = CharAE_get_nelt(aligner->out_OPs);
+	for (int k = 0; k < nout; k++)
+		_append_cigar_OP(cigar_buf, aligner->out_OPs->elts[k],
+				 aligner->out_OPLs->elts[k]);
+	return NULL;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   cigars:      a character vector containing CIGAR strings.
+ *   lmmpos:      integer vector of the same length as 'cigars' (or of
+ *                length 1) containing the 1-based leftmost mapping
+ *                positions.
+ *   seqs:        character vector parallel to 'cigars' containing the read
+ *                sequences (i.e. the SEQ field of a SAM file). An NA or "*"
+ *                means that the read sequence is not available, in which case
+ *                the insertions in the CIGAR are not shifted.
+ *   ref_seqs:    character vector containing the reference sequences.
+ *   seqnames:    integer vector of the same length as 'cigars' (or of
+ *                length 1) containing the 1-based index in 'ref_seqs' of
+ *                the reference sequence of each alignment.
+ *   na_on_error: TRUE or FALSE.
+ * The alignments with an NA lmmpos or seqname are left untouched.
+ * Returns a character vector parallel to 'cigars' containing the CIGARs
+ * where each I and D operation has been shifted to its leftmost equivalent
+ * position. The number of indels that were shifted in each CIGAR is stored
+ * in the "nshifted" attribute.
+ */
+SEXP C_left_align_indels(SEXP cigars, SEXP lmmpos, SEXP seqs, SEXP ref_seqs,
+			 SEXP seqnames, SEXP na_on_error)
+{
+	R_xlen_t ncigars = XLENGTH(cigars);
+	R_xlen_t lmmpos_len = XLENGTH(lmmpos);
+	R_xlen_t seqnames_len = XLENGTH(seqnames);
+	const int *lmmpos_p = INTEGER(lmmpos);
+	const int *seqnames_p = INTEGER(seqnames);
+	CharAE *OP_buf = new_CharAE(0);
+	IntAE *OPL_buf = new_IntAE(0, 0, 0);
+	CharAE *cigar_buf = new_CharAE(0);
+	Aligner aligner;
+	aligner.out_OPs = new_CharAE(0);
+	aligner.out_OPLs = new_IntAE(0, 0, 0);
+	Seq read, ref;
+
+	SEXP ans = PROTECT(NEW_CHARACTER(ncigars));
+	SEXP ans_nshifted = PROTECT(NEW_INTEGER(ncigars));
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, ncigars));
+	int *nshifted_p = INTEGER(ans_nshifted);
+	for (R_xlen_t i = 0; i < ncigars; i++) {
+		SEXP cigar_string = STRING_ELT(cigars, i);
+		int pos = lmmpos_p[lmmpos_len == 1 ? 0 : i];
+		int s = seqnames_p[seqnames_len == 1 ? 0 : i];
+		nshifted_p[i] = 0;
+		if (cigar_string == NA_STRING) {
+			SET_STRING_ELT(ans, i, NA_STRING);
+			nshifted_p[i] = NA_INTEGER;
+			if (errcodes != R_NilValue)
+				INTEGER(errcodes)[i] = CIGAR_IS_NA;
+			continue;
+		}
+		if (pos == NA_INTEGER || s == NA_INTEGER ||
+		    (LENGTH(cigar_string) == 1 && CHAR(cigar_string)[0] == '*'))
+		{
+			SET_STRING_ELT(ans, i, cigar_string);
+			continue;
+		}
+		get_seq(seqs, i, &read);
+		get_seq(ref_seqs, s - 1, &ref);
+		const char *errmsg;
+		if (LENGTH(cigar_string) == 0) {
+			errmsg = _empty_cigar_error();
+		} else {
+			errmsg = left_align_cigar(CHAR(cigar_string), pos,
+					read.letters == NULL ? NULL : &read, &ref,
+					OP_buf, OPL_buf, &aligner,
+					cigar_buf, nshifted_p + i);
+		}
+		if (errmsg == errmsg_buf) {
+			/* Not a problem with the CIGAR itself. */
+			UNPROTECT(3);
+			error("in 'seqs[%lld]': %s", (long long) i + 1, errmsg);
+		}
+		if (errmsg != NULL) {
+			if (errcodes == R_NilValue) {
+				UNPROTECT(3);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			SET_STRING_ELT(ans, i, NA_STRING);
+			nshifted_p[i] = NA_INTEGER;
+			INTEGER(errcodes)[i] = _errmsg_as_errcode(errmsg);
+			continue;
+		}
+		if (nshifted_p[i] == 0) {
+			SET_STRING_ELT(ans, i, cigar_string);
+			continue;
+		}
+		SEXP ans_elt = PROTECT(mkCharLen(cigar_buf->elts,
+					CharAE_get_nelt(cigar_buf)));
+		SET_STRING_ELT(ans, i, ans_elt);
+		UNPROTECT(1);
+	}
+	setAttrib(ans, install("nshifted"), ans_nshifted);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(3);
+	return ans;
+}
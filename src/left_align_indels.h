@@ -0,0 +1,15 @@
+#ifndef _LEFT_ALIGN_INDELS_H_
+#define _LEFT_ALIGN_INDELS_H_
+
+#include <Rdefines.h>
+
+SEXP C_left_align_indels(
+	SEXP cigars,
+	SEXP lmmpos,
+	SEXP seqs,
+	SEXP ref_seqs,
+	SEXP seqnames,
+	SEXP na_on_error
+);
+
+#endif  /* _LEFT_ALIGN_INDELS_H_ */
@@ -3,6 +3,7 @@
 #include "S4Vectors_interface.h"
 
 #include "project_positions.h"
+#include "bam_cigars.h"
 
 
 /*
@@ -23,7 +24,10 @@
  * Args:
  *   start, end:     two parallel integer vectors describing ranges along
  *                   the reference space (input ranges);
- *   cigars, lmmpos: two parallel vectors (one character, one integer).
+ *   cigars:         character vector containing the extended CIGARs, or
+ *                   CompressedRawList or CigarStore object containing
+ *                   BAM-encoded CIGARs (see _new_CigarsHolder());
+ *   lmmpos:         integer vector of length 1 or parallel to 'cigars'.
  * Returns a list of length four that describes the hits between the input
  * ranges and the cigar/lmmpos pairs. All list elements are parallel integer
  * vectors of length N, where N is the number of hits.
@@ -40,28 +44,39 @@ SEXP C_map_ref_ranges_to_query(SEXP start, SEXP end, SEXP cigars, SEXP lmmpos)
 {
 	SEXP ans, ans_start, ans_end, ans_qhits, ans_shits;
 	IntAE *sbuf, *ebuf, *qhbuf, *shbuf;
-	int i, j, s, e;
-	int nranges = LENGTH(start);
-	int ncigars = LENGTH(cigars);
+	int s, e;
+	R_xlen_t nranges = XLENGTH(start);
+	CigarsHolder cigars_holder = _new_CigarsHolder(cigars);
+	R_xlen_t ncigars = cigars_holder.length;
+	R_xlen_t lmmpos_len = XLENGTH(lmmpos);
+	Cigar cig_j;
 
+	/* The hits are reported with 1-based int indices. */
+	if (nranges > INT_MAX || ncigars > INT_MAX)
+		error("map_ref_ranges_to_query() does not support more "
+		      "than %d input ranges or CIGARs", INT_MAX);
 	sbuf = new_IntAE(0, 0, 0);
 	ebuf = new_IntAE(0, 0, 0);
 	qhbuf = new_IntAE(0, 0, 0);
 	shbuf = new_IntAE(0, 0, 0);
-	for (i = 0; i < nranges; i++) {
-		for (j = 0; j < ncigars; j++) {
-			const char *cig_j = CHAR(STRING_ELT(cigars, j));
-			int pos_j = INTEGER(lmmpos)[j];
-			s = _to_query(INTEGER(start)[i], cig_j, pos_j, FALSE);
+	for (R_xlen_t i = 0; i < nranges; i++) {
+		for (R_xlen_t j = 0; j < ncigars; j++) {
+			if (!_get_cigar(&cigars_holder, j, &cig_j) ||
+			    _cigar_is_star(&cig_j))
+				continue;
+			int pos_j = INTEGER(lmmpos)[lmmpos_len == 1 ? 0 : j];
+			s = _to_query(INTEGER(start)[i], &cig_j, pos_j, FALSE);
 			if (s == NA_INTEGER)
 				continue;
-			e = _to_query(INTEGER(end)[i], cig_j, pos_j, TRUE);
+			e = _to_query(INTEGER(end)[i], &cig_j, pos_j, TRUE);
 			if (e == NA_INTEGER)
 				continue;
 			IntAE_insert_at(sbuf, IntAE_get_nelt(sbuf), s);
 			IntAE_insert_at(ebuf, IntAE_get_nelt(ebuf), e);
-			IntAE_insert_at(qhbuf, IntAE_get_nelt(qhbuf), i + 1);
-			IntAE_insert_at(shbuf, IntAE_get_nelt(shbuf), j + 1);
+			IntAE_insert_at(qhbuf, IntAE_get_nelt(qhbuf),
+					(int) i + 1);
+			IntAE_insert_at(shbuf, IntAE_get_nelt(shbuf),
+					(int) j + 1);
 		}
 	}
 
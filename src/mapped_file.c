@@ -0,0 +1,104 @@
+#include "mapped_file.h"
+
+#include <stdio.h>   /* for fopen(), fread() */
+#include <stdlib.h>  /* for malloc(), free() */
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+/****************************************************************************
+ * _map_file() and _unmap_file()
+ *
+ * On Unix-like systems the file is mmap'ed read-only. When 'sequential' is
+ * TRUE, the kernel is told that we're going to read the file sequentially.
+ * This triggers aggressive read-ahead so the disk keeps feeding the page
+ * cache while we process the part of the file that is already in memory.
+ * On Windows we fall back to reading the part of the file that starts at
+ * 'offset' in a malloc'ed buffer.
+ */
+
+/* Returns NULL on success, or an error message. If 'offset' is not before
+   the end of the file, then nothing is mapped and 'mf->size' is set to 0. */
+const char *_map_file(const char *path, size_t offset, int sequential,
+		MappedFile *mf)
+{
+	mf->data = NULL;
+	mf->size = mf->base_size = 0;
+	mf->base = NULL;
+#ifndef _WIN32
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return "cannot open file";
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return "cannot stat file";
+	}
+	size_t file_size = (size_t) st.st_size;
+	if (offset >= file_size) {
+		close(fd);
+		return NULL;
+	}
+	void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return "cannot map file in memory";
+	if (sequential)
+		madvise(map, file_size, MADV_SEQUENTIAL);
+	mf->base = map;
+	mf->base_size = file_size;
+	mf->data = (const char *) map + offset;
+	mf->size = file_size - offset;
+#else
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+		return "cannot open file";
+	if (_fseeki64(fp, 0, SEEK_END) != 0) {
+		fclose(fp);
+		return "cannot seek in file";
+	}
+	long long file_size = _ftelli64(fp);
+	if (file_size < 0 || (long long) offset >= file_size) {
+		fclose(fp);
+		return NULL;
+	}
+	size_t size = (size_t) (file_size - offset);
+	char *data = (char *) malloc(size);
+	if (data == NULL) {
+		fclose(fp);
+		return "cannot allocate memory to read file";
+	}
+	if (_fseeki64(fp, (long long) offset, SEEK_SET) != 0 ||
+	    fread(data, 1, size, fp) != size)
+	{
+		free(data);
+		fclose(fp);
+		return "error while reading file";
+	}
+	fclose(fp);
+	mf->base = data;
+	mf->base_size = size;
+	mf->data = data;
+	mf->size = size;
+#endif
+	return NULL;
+}
+
+void _unmap_file(MappedFile *mf)
+{
+	if (mf->base == NULL)
+		return;
+#ifndef _WIN32
+	munmap(mf->base, mf->base_size);
+#else
+	free(mf->base);
+#endif
+	mf->base = NULL;
+	return;
+}
+
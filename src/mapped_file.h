@@ -0,0 +1,25 @@
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <Rdefines.h>
+
+#include <stddef.h>  /* for size_t */
+
+typedef struct mapped_file_t {
+	const char *data;  /* points to the byte at 'offset' in the file */
+	size_t size;       /* nb of bytes from 'offset' to the end of file */
+	void *base;        /* what needs to be unmapped or freed */
+	size_t base_size;
+} MappedFile;
+
+const char *_map_file(
+	const char *path,
+	size_t offset,
+	int sequential,
+	MappedFile *mf
+);
+
+void _unmap_file(MappedFile *mf);
+
+#endif  /* _MAPPED_FILE_H_ */
+
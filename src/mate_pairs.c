@@ -0,0 +1,618 @@
+#include "mate_pairs.h"
+
+#include "cigar_ops_visibility.h"
+#include "explode_cigars.h"
+#include "cigar_extent.h"
+#include "trim_cigars.h"
+#include "softclip_cigars.h"
+#include "bam_cigars.h"
+
+#include <limits.h>  /* for INT_MAX */
+
+
+/* Supported values for the 'clip_mate' argument of C_clip_mate_overlaps(). */
+#define CLIP_MINUS_MATE   0
+#define CLIP_FIRST_MATE   1
+#define CLIP_SECOND_MATE  2
+#define CLIP_BOTH_MATES   3
+
+typedef struct mate_t {
+	SEXP cigar_string;
+	CharAE *OP_buf;
+	IntAE *OPL_buf;
+	int start, end;  /* 1-based start/end on the reference */
+} Mate;
+
+/* The CIGAR of an unmapped mate. */
+static int is_star(SEXP cigar_string)
+{
+	return LENGTH(cigar_string) == 1 && CHAR(cigar_string)[0] == '*';
+}
+
+/* Returns NULL on success, or an error message. */
+static const char *load_mate(Mate *mate, SEXP cigar_string, int lmmpos)
+{
+	mate->cigar_string = cigar_string;
+	const char *errmsg = _tokenize_cigar(CHAR(cigar_string),
+					     mate->OP_buf, mate->OPL_buf);
+	if (errmsg != NULL)
+		return errmsg;
+	long long end = lmmpos - 1LL + _tokens_extent(mate->OP_buf->elts,
+						mate->OPL_buf->elts,
+						IntAE_get_nelt(mate->OPL_buf),
+						REFERENCE);
+	if (end > INT_MAX)
+		return "alignment ends beyond position INT_MAX";
+	mate->start = lmmpos;
+	mate->end = (int) end;
+	return NULL;
+}
+
+/* Clip the first 'Lnpos' and last 'Rnpos' reference positions of 'mate'
+   and store the result in 'ans_cigars[i]' and 'ans_rshift[i]'. */
+static const char *clip_mate(const Mate *mate, int Lnpos, int Rnpos,
+		int softclip, CharAE *cigar_buf,
+		SEXP ans_cigars, int *ans_rshift, R_xlen_t i)
+{
+	int untouched = 0;
+	const char *errmsg;
+	if (softclip) {
+		errmsg = _softclip_cigar(mate->OP_buf->elts,
+					 mate->OPL_buf->elts,
+					 IntAE_get_nelt(mate->OPL_buf), 0,
+					 Lnpos, Rnpos,
+					 cigar_buf, ans_rshift + i, &untouched);
+	} else {
+		errmsg = _trim_cigar(mate->OP_buf->elts,
+				     mate->OPL_buf->elts,
+				     IntAE_get_nelt(mate->OPL_buf), 0,
+				     Lnpos, Rnpos,
+				     cigar_buf, ans_rshift + i, &untouched);
+	}
+	if (errmsg != NULL)
+		return errmsg;
+	if (untouched) {
+		SET_STRING_ELT(ans_cigars, i, mate->cigar_string);
+		return NULL;
+	}
+	SEXP ans_elt = PROTECT(mkCharLen(cigar_buf->elts,
+				CharAE_get_nelt(cigar_buf)));
+	SET_STRING_ELT(ans_cigars, i, ans_elt);
+	UNPROTECT(1);
+	return NULL;
+}
+
+static void set_NA_mate(SEXP ans_cigars, int *ans_rshift, R_xlen_t i)
+{
+	SET_STRING_ELT(ans_cigars, i, NA_STRING);
+	ans_rshift[i] = NA_INTEGER;
+	return;
+}
+
+static void set_untouched_mate(const Mate *mate,
+		SEXP ans_cigars, int *ans_rshift, R_xlen_t i)
+{
+	SET_STRING_ELT(ans_cigars, i, mate->cigar_string);
+	ans_rshift[i] = 0;
+	return;
+}
+
+/* Clip the overlapping part of a pair of mates. 'x' is the mate designated
+   for clipping and 'y' the other mate. If 'both' is 1, then the overlap is
+   split between the 2 mates, and the mate that is contained in the other
+   one (if any) is set to NA. Otherwise only 'x' is clipped or set to NA.
+   Returns NULL on success, or an error message. */
+static const char *clip_overlap(const Mate *x, const Mate *y, int both,
+		int softclip, CharAE *cigar_buf,
+		SEXP ans_cigars_x, int *ans_rshift_x,
+		SEXP ans_cigars_y, int *ans_rshift_y, R_xlen_t i)
+{
+	/* Is 'x' contained in 'y'? */
+	if (x->start >= y->start && x->end <= y->end) {
+		set_NA_mate(ans_cigars_x, ans_rshift_x, i);
+		set_untouched_mate(y, ans_cigars_y, ans_rshift_y, i);
+		return NULL;
+	}
+	const char *errmsg;
+	if (both) {
+		/* Is 'y' contained in 'x'? */
+		if (y->start >= x->start && y->end <= x->end) {
+			set_untouched_mate(x, ans_cigars_x, ans_rshift_x, i);
+			set_NA_mate(ans_cigars_y, ans_rshift_y, i);
+			return NULL;
+		}
+		/* The mate on the left keeps the first half of the overlap
+		   (rounded up), the mate on the right keeps the second half. */
+		const Mate *left = x, *right = y;
+		SEXP ans_cigars_left = ans_cigars_x,
+		     ans_cigars_right = ans_cigars_y;
+		int *ans_rshift_left = ans_rshift_x,
+		    *ans_rshift_right = ans_rshift_y;
+		if (y->start < x->start) {
+			left = y;
+			right = x;
+			ans_cigars_left = ans_cigars_y;
+			ans_cigars_right = ans_cigars_x;
+			ans_rshift_left = ans_rshift_y;
+			ans_rshift_right = ans_rshift_x;
+		}
+		int overlap_width = left->end - right->start + 1;
+		int left_keeps = (overlap_width + 1) / 2;
+		errmsg = clip_mate(left, 0, overlap_width - left_keeps,
+				   softclip, cigar_buf,
+				   ans_cigars_left, ans_rshift_left, i);
+		if (errmsg != NULL)
+			return errmsg;
+		return clip_mate(right, left_keeps, 0,
+				 softclip, cigar_buf,
+				 ans_cigars_right, ans_rshift_right, i);
+	}
+	/* Is 'y' strictly inside 'x'? Then 'x' cannot be clipped without
+	   being split in 2. Note that 'y' is never touched. */
+	if (y->start > x->start && y->end < x->end) {
+		set_NA_mate(ans_cigars_x, ans_rshift_x, i);
+		set_untouched_mate(y, ans_cigars_y, ans_rshift_y, i);
+		return NULL;
+	}
+	if (x->start < y->start) {
+		/* Clip the right end of 'x'. */
+		errmsg = clip_mate(x, 0, x->end - y->start + 1,
+				   softclip, cigar_buf,
+				   ans_cigars_x, ans_rshift_x, i);
+	} else {
+		/* Clip the left end of 'x'. */
+		errmsg = clip_mate(x, y->end - x->start + 1, 0,
+				   softclip, cigar_buf,
+				   ans_cigars_x, ans_rshift_x, i);
+	}
+	if (errmsg != NULL)
+		return errmsg;
+	set_untouched_mate(y, ans_cigars_y, ans_rshift_y, i);
+	return NULL;
+}
+
+
+/****************************************************************************
+ * C_clip_mate_overlaps()
+ */
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   cigars1, cigars2: 2 parallel character vectors containing the CIGAR
+ *               strings of the first and second mates.
+ *   lmmpos1, lmmpos2: integer vectors of the same length as 'cigars1' (or
+ *               of length 1) containing the 1-based leftmost mapping
+ *               positions of the first and second mates.
+ *   minus1, minus2: logical vectors of the same length as 'cigars1'
+ *               indicating whether the first and second mates are aligned
+ *               to the minus strand.
+ *   clip_mate:  a single integer indicating which mate to clip (see
+ *               CLIP_*_MATE* at the top of this file).
+ *   softclip:   TRUE or FALSE. Soft-clip or trim the overlapping part?
+ * The mates in each pair are assumed to be aligned to the same reference
+ * sequence.
+ * Returns a list of 4 elements:
+ *   1. The vector of clipped CIGARs for the first mates.
+ *   2. The 'rshift' vector for the first mates.
+ *   3. The vector of clipped CIGARs for the second mates.
+ *   4. The 'rshift' vector for the second mates.
+ */
+SEXP C_clip_mate_overlaps(SEXP cigars1, SEXP lmmpos1, SEXP minus1,
+			  SEXP cigars2, SEXP lmmpos2, SEXP minus2,
+			  SEXP clip_mate, SEXP softclip)
+{
+	R_xlen_t npairs = XLENGTH(cigars1);
+	R_xlen_t lmmpos1_len = XLENGTH(lmmpos1);
+	R_xlen_t lmmpos2_len = XLENGTH(lmmpos2);
+	const int *lmmpos1_p = INTEGER(lmmpos1);
+	const int *lmmpos2_p = INTEGER(lmmpos2);
+	const int *minus1_p = LOGICAL(minus1);
+	const int *minus2_p = LOGICAL(minus2);
+	int clip_mate0 = INTEGER(clip_mate)[0];
+	int softclip0 = LOGICAL(softclip)[0];
+
+	Mate mate1, mate2;
+	mate1.OP_buf = new_CharAE(0);
+	mate1.OPL_buf = new_IntAE(0, 0, 0);
+	mate2.OP_buf = new_CharAE(0);
+	mate2.OPL_buf = new_IntAE(0, 0, 0);
+	CharAE *cigar_buf = new_CharAE(0);
+
+	SEXP ans_cigars1 = PROTECT(NEW_CHARACTER(npairs));
+	SEXP ans_rshift1 = PROTECT(NEW_INTEGER(npairs));
+	SEXP ans_cigars2 = PROTECT(NEW_CHARACTER(npairs));
+	SEXP ans_rshift2 = PROTECT(NEW_INTEGER(npairs));
+	int *rshift1_p = INTEGER(ans_rshift1);
+	int *rshift2_p = INTEGER(ans_rshift2);
+	for (R_xlen_t i = 0; i < npairs; i++) {
+		SEXP cigar_string1 = STRING_ELT(cigars1, i);
+		SEXP cigar_string2 = STRING_ELT(cigars2, i);
+		int pos1 = lmmpos1_p[lmmpos1_len == 1 ? 0 : i];
+		int pos2 = lmmpos2_p[lmmpos2_len == 1 ? 0 : i];
+		if (cigar_string1 == NA_STRING || pos1 == NA_INTEGER ||
+		    cigar_string2 == NA_STRING || pos2 == NA_INTEGER ||
+		    is_star(cigar_string1) || is_star(cigar_string2))
+		{
+			/* Nothing to clip (e.g. unmapped mate). */
+			SET_STRING_ELT(ans_cigars1, i, cigar_string1);
+			rshift1_p[i] = cigar_string1 == NA_STRING ?
+				       NA_INTEGER : 0;
+			SET_STRING_ELT(ans_cigars2, i, cigar_string2);
+			rshift2_p[i] = cigar_string2 == NA_STRING ?
+				       NA_INTEGER : 0;
+			continue;
+		}
+		const char *errmsg = load_mate(&mate1, cigar_string1, pos1);
+		if (errmsg != NULL) {
+			UNPROTECT(4);
+			error("in 'cigars1[%lld]': %s",
+			      (long long) i + 1, errmsg);
+		}
+		errmsg = load_mate(&mate2, cigar_string2, pos2);
+		if (errmsg != NULL) {
+			UNPROTECT(4);
+			error("in 'cigars2[%lld]': %s",
+			      (long long) i + 1, errmsg);
+		}
+		if (mate1.end < mate2.start || mate2.end < mate1.start) {
+			/* No overlap. */
+			set_untouched_mate(&mate1, ans_cigars1, rshift1_p, i);
+			set_untouched_mate(&mate2, ans_cigars2, rshift2_p, i);
+			continue;
+		}
+		int clip_second;
+		switch (clip_mate0) {
+		    case CLIP_FIRST_MATE: clip_second = 0; break;
+		    case CLIP_SECOND_MATE: clip_second = 1; break;
+		    default:
+			/* Clip the mate on the minus strand, or the second
+			   mate if both mates are on the same strand. */
+			clip_second = !(minus1_p[i] == 1 && minus2_p[i] != 1);
+		}
+		int both = clip_mate0 == CLIP_BOTH_MATES;
+		if (clip_second) {
+			errmsg = clip_overlap(&mate2, &mate1, both,
+					      softclip0, cigar_buf,
+					      ans_cigars2, rshift2_p,
+					      ans_cigars1, rshift1_p, i);
+		} else {
+			errmsg = clip_overlap(&mate1, &mate2, both,
+					      softclip0, cigar_buf,
+					      ans_cigars1, rshift1_p,
+					      ans_cigars2, rshift2_p, i);
+		}
+		if (errmsg != NULL) {
+			UNPROTECT(4);
+			error("in pair %lld: %s", (long long) i + 1, errmsg);
+		}
+	}
+
+	SEXP ans = PROTECT(NEW_LIST(4));
+	SET_VECTOR_ELT(ans, 0, ans_cigars1);
+	SET_VECTOR_ELT(ans, 1, ans_rshift1);
+	SET_VECTOR_ELT(ans, 2, ans_cigars2);
+	SET_VECTOR_ELT(ans, 3, ans_rshift2);
+	UNPROTECT(5);
+	return ans;
+}
+
+
+
+/****************************************************************************
+ * C_fragment_extents()
+ */
+
+/* Computes the 1-based start/end on the reference of the i-th mate in
+   'cigars_holder'. If 'soft_clips' is 1, then the leading and trailing soft
+   clips are added to the mate i.e. the returned start/end are the "unclipped"
+   start/end of the mate. 'flags' is NULL or points to the flag of the mate.
+   Returns 0 on success, -1 if the mate is unmapped (or has an NA leftmost
+   mapping position), or an error code (see _errmsg_as_errcode()) if the
+   CIGAR is NA, "*", or cannot be parsed. In the latter case, '*errmsg' is
+   set to the parsing error. */
+static int get_mate_span(const CigarsHolder *cigars_holder, R_xlen_t i,
+		int lmmpos, const int *flags, int soft_clips,
+		long long *start, long long *end, const char **errmsg)
+{
+	Cigar cigar;
+	int offset = 0, n, OPL;
+	char OP;
+
+	if ((flags != NULL && (*flags & 0x004)) || lmmpos == NA_INTEGER)
+		return -1;
+	if (!_get_cigar(cigars_holder, i, &cigar) || _cigar_is_star(&cigar))
+		return CIGAR_IS_NA;
+	long long extent = 0, Lclip = 0, Rclip = 0;
+	int leading = 1;  /* are we still in the leading clips? */
+	while ((n = _next_OP(&cigar, offset, &OP, &OPL))) {
+		if (n == -1) {
+			*errmsg = _get_cigar_parsing_error();
+			return _errmsg_as_errcode(*errmsg);
+		}
+		offset += n;
+		if (OP == 'S') {
+			if (leading)
+				Lclip += OPL;
+			else
+				Rclip += OPL;
+			continue;
+		}
+		if (OP == 'H')
+			continue;
+		leading = 0;
+		Rclip = 0;
+		if (_op_is_visible(OP, REFERENCE))
+			extent += OPL;
+	}
+	*start = lmmpos;
+	*end = lmmpos + extent - 1;
+	if (soft_clips) {
+		*start -= Lclip;
+		*end += Rclip;
+	}
+	return 0;
+}
+
+/* The fragment goes from the 5' end of the mate on the plus strand to the
+   5' end of the mate on the minus strand. This removes the part of a mate
+   that reads past the start of the other mate (e.g. when the fragment is
+   shorter than the reads). If the mates are not on opposite strands, or
+   are facing outward, then the fragment is the union of the 2 mates. */
+static void get_fragment(long long start1, long long end1, int minus1,
+		long long start2, long long end2, int minus2,
+		long long *start, long long *end)
+{
+	if (minus1 != minus2) {
+		long long plus_start = minus1 ? start2 : start1;
+		long long minus_end = minus1 ? end1 : end2;
+		if (plus_start <= minus_end) {
+			*start = plus_start;
+			*end = minus_end;
+			return;
+		}
+	}
+	*start = start1 < start2 ? start1 : start2;
+	*end = end1 > end2 ? end1 : end2;
+	return;
+}
+
+/* Appends a run to the run-length encoding in 'values' and 'lengths'. */
+static void append_run(IntAE *values, IntAE *lengths, int value, int length)
+{
+	size_t nrun = IntAE_get_nelt(values);
+	if (length == 0)
+		return;
+	if (nrun != 0 && values->elts[nrun - 1] == value) {
+		lengths->elts[nrun - 1] += length;
+		return;
+	}
+	IntAE_insert_at(values, nrun, value);
+	IntAE_insert_at(lengths, nrun, length);
+	return;
+}
+
+/* Computes the run-length encoded coverage of the 'nfrag' fragments that
+   start at the positions in 'starts' and end right before the positions in
+   'ends_plus1' on a sequence of length 'seqlength'. The positions must be
+   in [1, seqlength + 1]. Both arrays get sorted in-place. */
+static void fragment_coverage(int *starts, int *ends_plus1, int nfrag,
+		int seqlength, IntAE *values, IntAE *lengths)
+{
+	sort_int_array(starts, nfrag, 0);
+	sort_int_array(ends_plus1, nfrag, 0);
+	IntAE_set_nelt(values, 0);
+	IntAE_set_nelt(lengths, 0);
+	int pos = 1, cvg = 0, a = 0, b = 0;
+	while (a < nfrag || b < nfrag) {
+		int next_pos = b < nfrag ? ends_plus1[b] : INT_MAX;
+		if (a < nfrag && starts[a] < next_pos)
+			next_pos = starts[a];
+		append_run(values, lengths, cvg, next_pos - pos);
+		pos = next_pos;
+		while (a < nfrag && starts[a] == pos) {
+			cvg++;
+			a++;
+		}
+		while (b < nfrag && ends_plus1[b] == pos) {
+			cvg--;
+			b++;
+		}
+	}
+	append_run(values, lengths, 0, seqlength - pos + 1);
+	return;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   cigars1, cigars2: 2 parallel character vectors, or CompressedRawList or
+ *               CigarStore objects (see _new_CigarsHolder()), containing
+ *               the CIGARs of the first and second mates.
+ *   lmmpos1, lmmpos2: see C_clip_mate_overlaps() above.
+ *   flags1, flags2: NULL or integer vectors parallel to 'cigars1'
+ *               containing the SAM flags of the first and second mates.
+ *   minus1, minus2: see C_clip_mate_overlaps() above.
+ *   soft_clips: TRUE or FALSE. Extend the mates with their soft clips?
+ *   seqnames:   NULL, or an integer vector of the same length as 'cigars1'
+ *               (or of length 1) containing the 1-based index of the
+ *               sequence of each pair (typically the codes of a factor).
+ *   seqlengths: integer vector with one element per sequence. An NA means
+ *               that the length of the sequence must be inferred from the
+ *               fragments (i.e. it's the end of the rightmost fragment on
+ *               the sequence). Ignored if 'seqnames' is NULL.
+ *   na_on_error: TRUE or FALSE. See C_cigar_extent() in src/cigar_extent.c.
+ *               The error code of a pair is the error code of its first
+ *               mate, or of its second mate if the first mate is valid.
+ * The fragment of a pair is NA if one of the mates is unmapped, or has an
+ * NA leftmost mapping position or CIGAR.
+ * Returns a list of 5 elements:
+ *   1. An integer vector parallel to 'cigars1' with the fragment starts.
+ *   2. An integer vector parallel to 'cigars1' with the fragment ends.
+ *   3. An integer vector parallel to 'cigars1' with the template lengths
+ *      (i.e. the fragment widths).
+ *   4. NULL if 'seqnames' is NULL, otherwise a list parallel to
+ *      'seqlengths' with the run values of the fragment coverage of each
+ *      sequence.
+ *   5. Same as 4. but with the run lengths.
+ * The fragments are computed in a single pass over the pairs. The coverage
+ * is computed afterwards, in separate passes over the fragments: they are
+ * clipped to [1, seqlength] and bucketed by sequence, then the starts and
+ * ends of each bucket are sorted and swept (see fragment_coverage()).
+ */
+SEXP C_fragment_extents(SEXP cigars1, SEXP lmmpos1, SEXP flags1, SEXP minus1,
+			SEXP cigars2, SEXP lmmpos2, SEXP flags2, SEXP minus2,
+			SEXP soft_clips, SEXP seqnames, SEXP seqlengths,
+			SEXP na_on_error)
+{
+	CigarsHolder cigars_holder1 = _new_CigarsHolder(cigars1);
+	CigarsHolder cigars_holder2 = _new_CigarsHolder(cigars2);
+	R_xlen_t npairs = cigars_holder1.length;
+	R_xlen_t lmmpos1_len = XLENGTH(lmmpos1);
+	R_xlen_t lmmpos2_len = XLENGTH(lmmpos2);
+	const int *lmmpos1_p = INTEGER(lmmpos1);
+	const int *lmmpos2_p = INTEGER(lmmpos2);
+	const int *flags1_p = flags1 == R_NilValue ? NULL : INTEGER(flags1);
+	const int *flags2_p = flags2 == R_NilValue ? NULL : INTEGER(flags2);
+	const int *minus1_p = LOGICAL(minus1);
+	const int *minus2_p = LOGICAL(minus2);
+	int soft_clips0 = LOGICAL(soft_clips)[0];
+	const char *errmsg;
+
+	SEXP ans_start = PROTECT(NEW_INTEGER(npairs));
+	SEXP ans_end = PROTECT(NEW_INTEGER(npairs));
+	SEXP ans_tlen = PROTECT(NEW_INTEGER(npairs));
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, npairs));
+	int *start_p = INTEGER(ans_start);
+	int *end_p = INTEGER(ans_end);
+	int *tlen_p = INTEGER(ans_tlen);
+	for (R_xlen_t i = 0; i < npairs; i++) {
+		const int *flag1 = flags1_p == NULL ? NULL : flags1_p + i;
+		const int *flag2 = flags2_p == NULL ? NULL : flags2_p + i;
+		if ((flag1 != NULL && *flag1 == NA_INTEGER) ||
+		    (flag2 != NULL && *flag2 == NA_INTEGER))
+		{
+			UNPROTECT(4);
+			error("'flags1' or 'flags2' contains NAs");
+		}
+		long long start1, end1, start2, end2;
+		int status1 = get_mate_span(&cigars_holder1, i,
+				lmmpos1_p[lmmpos1_len == 1 ? 0 : i], flag1,
+				soft_clips0, &start1, &end1, &errmsg);
+		if (status1 > CIGAR_IS_NA && errcodes == R_NilValue) {
+			UNPROTECT(4);
+			error("in 'cigars1[%lld]': %s",
+			      (long long) i + 1, errmsg);
+		}
+		int status2 = get_mate_span(&cigars_holder2, i,
+				lmmpos2_p[lmmpos2_len == 1 ? 0 : i], flag2,
+				soft_clips0, &start2, &end2, &errmsg);
+		if (status2 > CIGAR_IS_NA && errcodes == R_NilValue) {
+			UNPROTECT(4);
+			error("in 'cigars2[%lld]': %s",
+			      (long long) i + 1, errmsg);
+		}
+		if (status1 != 0 || status2 != 0) {
+			start_p[i] = end_p[i] = tlen_p[i] = NA_INTEGER;
+			if (errcodes != R_NilValue)
+				INTEGER(errcodes)[i] = status1 > 0 ? status1 :
+						       status2 > 0 ? status2 : 0;
+			continue;
+		}
+		long long start, end;
+		get_fragment(start1, end1, minus1_p[i] == 1,
+			     start2, end2, minus2_p[i] == 1, &start, &end);
+		if (start < -INT_MAX || end > INT_MAX) {
+			UNPROTECT(4);
+			error("in pair %lld: the fragment cannot be represented "
+			      "with 32-bit integer positions", (long long) i + 1);
+		}
+		start_p[i] = (int) start;
+		end_p[i] = (int) end;
+		tlen_p[i] = end - start + 1 > INT_MAX ?
+			    NA_INTEGER : (int) (end - start + 1);
+	}
+
+	SEXP ans_values = R_NilValue, ans_lengths = R_NilValue;
+	if (seqnames != R_NilValue) {
+		R_xlen_t seqnames_len = XLENGTH(seqnames);
+		const int *seqnames_p = INTEGER(seqnames);
+		int nseq = LENGTH(seqlengths);
+
+		/* Infer the missing sequence lengths and count the fragments
+		   of each sequence. */
+		int *seq_ends = (int *) R_alloc(nseq, sizeof(int));
+		R_xlen_t *nfrag = (R_xlen_t *) R_alloc(nseq + 1,
+						       sizeof(R_xlen_t));
+		for (int s = 0; s < nseq; s++) {
+			int seqlength = INTEGER(seqlengths)[s];
+			seq_ends[s] = seqlength == NA_INTEGER ? 0 : seqlength;
+			nfrag[s] = 0;
+		}
+		nfrag[nseq] = 0;
+		for (R_xlen_t i = 0; i < npairs; i++) {
+			int s = seqnames_p[seqnames_len == 1 ? 0 : i];
+			if (s == NA_INTEGER || start_p[i] == NA_INTEGER)
+				continue;
+			if (INTEGER(seqlengths)[s - 1] == NA_INTEGER &&
+			    end_p[i] > seq_ends[s - 1])
+				seq_ends[s - 1] = end_p[i];
+			nfrag[s]++;
+		}
+
+		/* Bucket the clipped fragments by sequence. */
+		for (int s = 0; s < nseq; s++)
+			nfrag[s + 1] += nfrag[s];
+		if (nfrag[nseq] > INT_MAX) {
+			UNPROTECT(4);
+			_too_many_elements_error("the coverage");
+		}
+		int *starts = (int *) R_alloc(nfrag[nseq], sizeof(int));
+		int *ends_plus1 = (int *) R_alloc(nfrag[nseq], sizeof(int));
+		R_xlen_t *bucket_nelt = (R_xlen_t *) R_alloc(nseq,
+						sizeof(R_xlen_t));
+		for (int s = 0; s < nseq; s++)
+			bucket_nelt[s] = 0;
+		for (R_xlen_t i = 0; i < npairs; i++) {
+			int s = seqnames_p[seqnames_len == 1 ? 0 : i];
+			if (s == NA_INTEGER || start_p[i] == NA_INTEGER)
+				continue;
+			s--;
+			int start = start_p[i] < 1 ? 1 : start_p[i];
+			int end = end_p[i] > seq_ends[s] ? seq_ends[s]
+							 : end_p[i];
+			if (start > end)
+				continue;
+			R_xlen_t k = nfrag[s] + bucket_nelt[s]++;
+			starts[k] = start;
+			ends_plus1[k] = end + 1;
+		}
+
+		/* Compute the coverage of each sequence. */
+		ans_values = PROTECT(NEW_LIST(nseq));
+		ans_lengths = PROTECT(NEW_LIST(nseq));
+		IntAE *values = new_IntAE(0, 0, 0);
+		IntAE *lengths = new_IntAE(0, 0, 0);
+		for (int s = 0; s < nseq; s++) {
+			fragment_coverage(starts + nfrag[s],
+					  ends_plus1 + nfrag[s],
+					  (int) bucket_nelt[s], seq_ends[s],
+					  values, lengths);
+			SET_VECTOR_ELT(ans_values, s,
+				       new_INTEGER_from_IntAE(values));
+			SET_VECTOR_ELT(ans_lengths, s,
+				       new_INTEGER_from_IntAE(lengths));
+		}
+	} else {
+		PROTECT(ans_values);
+		PROTECT(ans_lengths);
+	}
+
+	SEXP ans = PROTECT(NEW_LIST(5));
+	SET_VECTOR_ELT(ans, 0, ans_start);
+	SET_VECTOR_ELT(ans, 1, ans_end);
+	SET_VECTOR_ELT(ans, 2, ans_tlen);
+	SET_VECTOR_ELT(ans, 3, ans_values);
+	SET_VECTOR_ELT(ans, 4, ans_lengths);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(7);
+	return ans;
+}
@@ -0,0 +1,35 @@
+#ifndef _MATE_PAIRS_H_
+#define _MATE_PAIRS_H_
+
+#include <Rdefines.h>
+
+#include "S4Vectors_interface.h"
+
+SEXP C_clip_mate_overlaps(
+	SEXP cigars1,
+	SEXP lmmpos1,
+	SEXP minus1,
+	SEXP cigars2,
+	SEXP lmmpos2,
+	SEXP minus2,
+	SEXP clip_mate,
+	SEXP softclip
+);
+
+SEXP C_fragment_extents(
+	SEXP cigars1,
+	SEXP lmmpos1,
+	SEXP flags1,
+	SEXP minus1,
+	SEXP cigars2,
+	SEXP lmmpos2,
+	SEXP flags2,
+	SEXP minus2,
+	SEXP soft_clips,
+	SEXP seqnames,
+	SEXP seqlengths,
+	SEXP na_on_error
+);
+
+#endif  /* _MATE_PAIRS_H_ */
+
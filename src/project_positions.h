@@ -3,19 +3,7 @@
 
 #include <Rdefines.h>
 
-int _to_ref(
-	int query_pos,
-	const char *cig,
-	int lmmpos,
-	Rboolean narrow_left
-);
-
-int _to_query(
-	int ref_pos,
-	const char *cig,
-	int lmmpos,
-	Rboolean narrow_left
-);
+#include "explode_cigars.h"
 
 SEXP C_query_pos_as_ref_pos(
 	SEXP query_pos,
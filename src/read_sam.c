@@ -0,0 +1,329 @@
+#include "read_sam.h"
+
+#include "S4Vectors_interface.h"
+
+#include "cigar_ops_visibility.h"
+#include "explode_cigars.h"
+#include "cigar_extent.h"
+#include "mapped_file.h"
+
+#include <stdio.h>   /* for snprintf() */
+#include <string.h>  /* for memchr(), memcpy() */
+#include <limits.h>  /* for INT_MAX */
+
+
+/* The 11 mandatory fields of a SAM line, followed by 2 pseudo-columns that
+   are computed from the CIGAR field. The codes passed to C_read_sam_columns()
+   are the 0-based indices in this list. Must be kept in sync with the
+   .SAM_COLUMNS vector defined in R/read_sam.R */
+#define QNAME_COL         0
+#define FLAG_COL          1
+#define RNAME_COL         2
+#define POS_COL           3
+#define MAPQ_COL          4
+#define CIGAR_COL         5
+#define RNEXT_COL         6
+#define PNEXT_COL         7
+#define TLEN_COL          8
+#define SEQ_COL           9
+#define QUAL_COL         10
+#define REF_EXTENT_COL   11
+#define QUERY_EXTENT_COL 12
+#define SAM_NFIELDS      11
+
+static char errmsg_buf[200];
+
+
+/****************************************************************************
+ * Tokenizing the SAM lines
+ */
+
+typedef struct sam_line_t {
+	const char *field_start[SAM_NFIELDS];
+	const char *field_end[SAM_NFIELDS];
+	const char *tags_start;  /* start of the optional fields */
+	const char *end;         /* end of the line (excluding \r\n) */
+} SamLine;
+
+/* Returns a pointer to the first char of the next line. */
+static const char *next_line(const char *p, const char *buf_end)
+{
+	const char *eol = memchr(p, '\n', buf_end - p);
+	return eol == NULL ? buf_end : eol + 1;
+}
+
+static int is_record_line(const char *line, const char *buf_end)
+{
+	return line < buf_end && *line != '@' && *line != '\n' &&
+	       *line != '\r';
+}
+
+/* Returns NULL on success, or an error message. */
+static const char *split_sam_line(const char *line, const char *buf_end,
+		SamLine *sam_line)
+{
+	const char *line_end = memchr(line, '\n', buf_end - line);
+	if (line_end == NULL)
+		line_end = buf_end;
+	if (line_end > line && line_end[-1] == '\r')
+		line_end--;
+	const char *p = line;
+	for (int j = 0; j < SAM_NFIELDS; j++) {
+		if (p > line_end)
+			return "line has less than 11 fields";
+		const char *tab = memchr(p, '\t', line_end - p);
+		if (tab == NULL)
+			tab = line_end;
+		sam_line->field_start[j] = p;
+		sam_line->field_end[j] = tab;
+		p = tab + 1;
+	}
+	sam_line->tags_start = p;
+	sam_line->end = line_end;
+	return NULL;
+}
+
+/* Returns NULL on success, or an error message. */
+static const char *parse_int_field(const char *start, const char *end,
+		int *val)
+{
+	const char *p = start;
+	int neg = p < end && *p == '-';
+	if (neg)
+		p++;
+	if (p == end)
+		return "empty integer field";
+	long long x = 0;
+	for ( ; p < end; p++) {
+		if (*p < '0' || *p > '9')
+			return "invalid integer field";
+		x = x * 10 + (*p - '0');
+		if (x > INT_MAX)
+			return "integer field is too big";
+	}
+	*val = neg ? (int) -x : (int) x;
+	return NULL;
+}
+
+/* Looks for tag 'tag' (2 letters) in the optional fields and sets
+   '*val_start' and '*val_end' to the value part of the field (i.e. what
+   comes after "XX:T:"). Returns 0 if the tag is not found. */
+static int find_tag(const SamLine *sam_line, const char *tag,
+		const char **val_start, const char **val_end)
+{
+	const char *p = sam_line->tags_start;
+	while (p < sam_line->end) {
+		const char *tab = memchr(p, '\t', sam_line->end - p);
+		if (tab == NULL)
+			tab = sam_line->end;
+		if (tab - p >= 5 && p[0] == tag[0] && p[1] == tag[1] &&
+		    p[2] == ':' && p[4] == ':')
+		{
+			*val_start = p + 5;
+			*val_end = tab;
+			return 1;
+		}
+		p = tab + 1;
+	}
+	return 0;
+}
+
+/* Compute the extent of the CIGAR field without creating a CHARSXP. The
+   field is copied to 'cigar_buf' only to nul-terminate it. */
+static const char *cigar_field_extent(const char *start, const char *end,
+		int space, CharAE *cigar_buf, CharAE *OP_buf, IntAE *OPL_buf,
+		int *extent)
+{
+	if (end - start == 1 && *start == '*') {
+		*extent = NA_INTEGER;
+		return NULL;
+	}
+	size_t cigar_len = end - start;
+	/* CharAE_insert_at() grows the buffer as needed. */
+	CharAE_set_nelt(cigar_buf, 0);
+	for (size_t j = 0; j <= cigar_len; j++) {
+		const char *elts0 = cigar_buf->elts;
+		CharAE_insert_at(cigar_buf, j, j < cigar_len ? start[j] : '\0');
+		STATS_COUNT_GROWTH(elts0, cigar_buf->elts);
+	}
+	const char *errmsg = _tokenize_cigar(cigar_buf->elts, OP_buf, OPL_buf);
+	if (errmsg != NULL)
+		return errmsg;
+	long long x = _tokens_extent(OP_buf->elts, OPL_buf->elts,
+				     IntAE_get_nelt(OPL_buf), space);
+	if (x > INT_MAX)
+		return "CIGAR extent is greater than INT_MAX";
+	*extent = (int) x;
+	return NULL;
+}
+
+
+/****************************************************************************
+ * C_read_sam_columns()
+ */
+
+static int col_is_integer(int col)
+{
+	return col == FLAG_COL || col == POS_COL || col == MAPQ_COL ||
+	       col == PNEXT_COL || col == TLEN_COL ||
+	       col == REF_EXTENT_COL || col == QUERY_EXTENT_COL;
+}
+
+/* Returns NULL on success, or an error message. */
+static const char *fill_columns(const SamLine *sam_line, R_xlen_t i,
+		const int *cols, int ncols, SEXP ans_cols,
+		SEXP tags, SEXP ans_tags,
+		CharAE *cigar_buf, CharAE *OP_buf, IntAE *OPL_buf)
+{
+	const char *errmsg;
+	for (int k = 0; k < ncols; k++) {
+		int col = cols[k];
+		SEXP ans_col = VECTOR_ELT(ans_cols, k);
+		if (col == REF_EXTENT_COL || col == QUERY_EXTENT_COL) {
+			int flag;
+			errmsg = parse_int_field(sam_line->field_start[FLAG_COL],
+						 sam_line->field_end[FLAG_COL],
+						 &flag);
+			if (errmsg != NULL)
+				return errmsg;
+			if (flag & 0x004) {
+				/* Unmapped read. */
+				INTEGER(ans_col)[i] = NA_INTEGER;
+				continue;
+			}
+			int space = col == REF_EXTENT_COL ? REFERENCE : QUERY;
+			errmsg = cigar_field_extent(
+					sam_line->field_start[CIGAR_COL],
+					sam_line->field_end[CIGAR_COL],
+					space, cigar_buf, OP_buf, OPL_buf,
+					INTEGER(ans_col) + i);
+			if (errmsg != NULL)
+				return errmsg;
+			continue;
+		}
+		const char *start = sam_line->field_start[col],
+			   *end = sam_line->field_end[col];
+		if (col_is_integer(col)) {
+			errmsg = parse_int_field(start, end,
+						 INTEGER(ans_col) + i);
+			if (errmsg != NULL)
+				return errmsg;
+			continue;
+		}
+		SEXP ans_elt = PROTECT(mkCharLen(start, end - start));
+		SET_STRING_ELT(ans_col, i, ans_elt);
+		UNPROTECT(1);
+	}
+	int ntags = LENGTH(tags);
+	for (int k = 0; k < ntags; k++) {
+		SEXP ans_tag = VECTOR_ELT(ans_tags, k);
+		const char *start, *end;
+		if (!find_tag(sam_line, CHAR(STRING_ELT(tags, k)),
+			      &start, &end))
+		{
+			SET_STRING_ELT(ans_tag, i, NA_STRING);
+			continue;
+		}
+		SEXP ans_elt = PROTECT(mkCharLen(start, end - start));
+		SET_STRING_ELT(ans_tag, i, ans_elt);
+		UNPROTECT(1);
+	}
+	return NULL;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   filepath: the path to an uncompressed SAM file.
+ *   cols:     integer vector of column codes (see *_COL at the top of this
+ *             file).
+ *   tags:     character vector of 2-letter tags.
+ *   offset:   a single double. The byte offset in the file where to start
+ *             reading (must be the beginning of a line).
+ *   nrec:     a single integer. The maximum number of records to read, or
+ *             NA to read all the remaining records.
+ * Header lines (i.e. lines starting with @) are skipped.
+ * Returns a list of 3 elements:
+ *   1. A list parallel to 'cols' containing the requested columns.
+ *   2. A list parallel to 'tags' containing the values of the requested
+ *      tags (without the "XX:T:" prefix), or NAs for missing tags.
+ *   3. The offset of the next record to read, or NA if the end of the file
+ *      was reached.
+ */
+SEXP C_read_sam_columns(SEXP filepath, SEXP cols, SEXP tags,
+		SEXP offset, SEXP nrec)
+{
+	const char *path = R_ExpandFileName(
+				translateChar(STRING_ELT(filepath, 0)));
+	double offset0 = REAL(offset)[0];
+	int nrec0 = INTEGER(nrec)[0];
+	const int *cols_p = INTEGER(cols);
+	int ncols = LENGTH(cols);
+	int ntags = LENGTH(tags);
+
+	MappedFile buf;
+	const char *errmsg = _map_file(path, (size_t) offset0, 1, &buf);
+	if (errmsg != NULL)
+		error("%s '%s'", errmsg, path);
+	const char *buf_end = buf.data + buf.size;
+
+	/* 1st pass: count the records to read. */
+	R_xlen_t nrecords = 0;
+	const char *line = buf.data;
+	while (line < buf_end && (nrec0 == NA_INTEGER || nrecords < nrec0)) {
+		if (is_record_line(line, buf_end))
+			nrecords++;
+		line = next_line(line, buf_end);
+	}
+	/* Skip the header lines and empty lines that follow the last record
+	   so we report the end of the file as soon as possible. */
+	while (line < buf_end && !is_record_line(line, buf_end))
+		line = next_line(line, buf_end);
+	const char *chunk_end = line;
+
+	/* 2nd pass: extract the columns. */
+	SEXP ans_cols = PROTECT(NEW_LIST(ncols));
+	for (int k = 0; k < ncols; k++) {
+		SEXPTYPE type = col_is_integer(cols_p[k]) ? INTSXP : STRSXP;
+		SET_VECTOR_ELT(ans_cols, k, allocVector(type, nrecords));
+	}
+	SEXP ans_tags = PROTECT(NEW_LIST(ntags));
+	for (int k = 0; k < ntags; k++)
+		SET_VECTOR_ELT(ans_tags, k, NEW_CHARACTER(nrecords));
+	CharAE *cigar_buf = new_CharAE(0);
+	CharAE *OP_buf = new_CharAE(0);
+	IntAE *OPL_buf = new_IntAE(0, 0, 0);
+	R_xlen_t i = 0;
+	SamLine sam_line;
+	for (line = buf.data; line < chunk_end;
+	     line = next_line(line, chunk_end))
+	{
+		if (!is_record_line(line, chunk_end))
+			continue;
+		errmsg = split_sam_line(line, chunk_end, &sam_line);
+		if (errmsg == NULL)
+			errmsg = fill_columns(&sam_line, i, cols_p, ncols,
+					      ans_cols, tags, ans_tags,
+					      cigar_buf, OP_buf, OPL_buf);
+		if (errmsg != NULL) {
+			snprintf(errmsg_buf, sizeof(errmsg_buf),
+				 "in SAM record %lld: %s",
+				 (long long) i + 1, errmsg);
+			_unmap_file(&buf);
+			UNPROTECT(2);
+			error("%s", errmsg_buf);
+		}
+		i++;
+	}
+	double next_offset = chunk_end < buf_end ?
+			     offset0 + (double) (chunk_end - buf.data) :
+			     NA_REAL;
+	_unmap_file(&buf);
+
+	SEXP ans = PROTECT(NEW_LIST(3));
+	SET_VECTOR_ELT(ans, 0, ans_cols);
+	SET_VECTOR_ELT(ans, 1, ans_tags);
+	SET_VECTOR_ELT(ans, 2, ScalarReal(next_offset));
+	UNPROTECT(3);
+	return ans;
+}
+
@@ -0,0 +1,15 @@
+#ifndef _READ_SAM_H_
+#define _READ_SAM_H_
+
+#include <Rdefines.h>
+
+SEXP C_read_sam_columns(
+	SEXP filepath,
+	SEXP cols,
+	SEXP tags,
+	SEXP offset,
+	SEXP nrec
+);
+
+#endif  /* _READ_SAM_H_ */
+
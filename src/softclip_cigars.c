@@ -0,0 +1,245 @@
+#include "softclip_cigars.h"
+
+#include "explode_cigars.h"
+#include "implode_cigars.h"
+
+
+
+/****************************************************************************
+ * softclip_one_end()
+ *
+ * Walk on the CIGAR operations previously extracted by _tokenize_cigar(),
+ * starting from the left end if 'step' is 1, or from the right end if
+ * 'step' is -1, and turn the first (or last) 'npos' positions into soft
+ * clipping. The positions are counted along the query space (soft clips
+ * included, hard clips excluded) if 'along_query' is 1, or along the
+ * reference space if 'along_query' is 0.
+ * The existing soft clips get merged with the new soft clipping, and the
+ * insertions, deletions, skipped regions, or paddings that end up at the new
+ * boundary are also clipped (insertions) or dropped (the others) so that
+ * the first (or last) operation that is not a clip is always an M, =, or X.
+ * On return:
+ *   - '*nH' is the number of hard clip operations found at the end;
+ *   - '*nS' is the total length of the soft clipping;
+ *   - '*idx' is the index of the first (or last) operation to keep;
+ *   - '*cut' is the number of positions to cut from that operation;
+ *   - '*rshift' is the number of reference positions that got clipped;
+ *   - '*changed' is set to 1 if any operation other than a soft or hard
+ *     clip got clipped or dropped.
+ */
+
+static const char *softclip_one_end(const char *OPs, const int *OPLs,
+		int nops, int step, int along_query, int npos,
+		int *nH, int *nS, int *idx, int *cut, int *rshift, int *changed)
+{
+	int i = step == 1 ? 0 : nops - 1;
+	*nH = *nS = *cut = *rshift = *changed = 0;
+	for ( ; 0 <= i && i < nops && OPs[i] == 'H'; i += step)
+		(*nH)++;
+	for ( ; 0 <= i && i < nops; i += step) {
+		char OP = OPs[i];
+		int OPL = OPLs[i];
+		switch (OP) {
+		/* Soft clip on the read */
+		    case 'S':
+			*nS += OPL;
+			if (along_query)
+				npos = npos <= OPL ? 0 : npos - OPL;
+		    break;
+		/* Alignment match (can be a sequence match or mismatch) */
+		    case 'M': case '=': case 'X':
+			if (npos < OPL) {
+				*idx = i;
+				*cut = npos;
+				*nS += npos;
+				*rshift += npos;
+				if (npos != 0)
+					*changed = 1;
+				return NULL;
+			}
+			*nS += OPL;
+			*rshift += OPL;
+			npos -= OPL;
+			*changed = 1;
+		    break;
+		/* Insertion to the reference */
+		    case 'I':
+			if (npos == 0 && !*changed) {
+				*idx = i;
+				return NULL;
+			}
+			*nS += OPL;
+			if (along_query)
+				npos = npos <= OPL ? 0 : npos - OPL;
+			*changed = 1;
+		    break;
+		/* Deletion (or skipped region) from the reference */
+		    case 'D': case 'N':
+			if (npos == 0 && !*changed) {
+				*idx = i;
+				return NULL;
+			}
+			*rshift += OPL;
+			if (!along_query)
+				npos = npos <= OPL ? 0 : npos - OPL;
+			*changed = 1;
+		    break;
+		/* Silent deletion from the padded reference */
+		    case 'P':
+			if (npos == 0 && !*changed) {
+				*idx = i;
+				return NULL;
+			}
+			*changed = 1;
+		    break;
+		/* Hard clip on the read (at the other end) */
+		    case 'H':
+			return _empty_after_softclipping_error();
+		    default: return _unknown_cigar_op_error(OP, i);
+		}
+	}
+	return _empty_after_softclipping_error();
+}
+
+
+/****************************************************************************
+ * _softclip_cigar()
+ */
+
+/* Soft-clip the CIGAR operations previously extracted by _tokenize_cigar()
+   and write the resulting CIGAR to 'cigar_buf'.
+   Sets '*untouched' to 1 if the soft-clipping leaves the CIGAR unchanged,
+   in which case nothing is written to 'cigar_buf'. */
+const char *_softclip_cigar(const char *OPs, const int *OPLs, int nops,
+		int along_query, int Lnpos, int Rnpos,
+		CharAE *cigar_buf, int *rshift, int *untouched)
+{
+	int LnH, LnS, Lidx, Lcut, Lchanged;
+	const char *errmsg = softclip_one_end(OPs, OPLs, nops, 1,
+					along_query, Lnpos,
+					&LnH, &LnS, &Lidx, &Lcut, rshift,
+					&Lchanged);
+	if (errmsg != NULL)
+		return errmsg;
+	int RnH, RnS, Ridx, Rcut, Rrshift, Rchanged;
+	errmsg = softclip_one_end(OPs, OPLs, nops, -1,
+				  along_query, Rnpos,
+				  &RnH, &RnS, &Ridx, &Rcut, &Rrshift,
+				  &Rchanged);
+	if (errmsg != NULL)
+		return errmsg;
+	if (Ridx < Lidx)
+		return _empty_after_softclipping_error();
+	*untouched = !(Lchanged || Rchanged);
+	if (*untouched)
+		return NULL;
+	CharAE_set_nelt(cigar_buf, 0);
+	for (int i = 0; i < LnH; i++)
+		_append_cigar_OP(cigar_buf, 'H', OPLs[i]);
+	if (LnS != 0)
+		_append_cigar_OP(cigar_buf, 'S', LnS);
+	int has_match = 0;
+	for (int i = Lidx; i <= Ridx; i++) {
+		char OP = OPs[i];
+		int OPL = OPLs[i];
+		if (i == Lidx)
+			OPL -= Lcut;
+		if (i == Ridx)
+			OPL -= Rcut;
+		if (OPL <= 0)
+			return _empty_after_softclipping_error();
+		if (OP == 'M' || OP == '=' || OP == 'X')
+			has_match = 1;
+		_append_cigar_OP(cigar_buf, OP, OPL);
+	}
+	if (!has_match)
+		return _empty_after_softclipping_error();
+	if (RnS != 0)
+		_append_cigar_OP(cigar_buf, 'S', RnS);
+	for (int i = nops - RnH; i < nops; i++)
+		_append_cigar_OP(cigar_buf, 'H', OPLs[i]);
+	return NULL;
+}
+
+static SEXP softclip_cigars(SEXP cigars, SEXP Lnpos, SEXP Rnpos,
+		SEXP na_on_error, int along_query)
+{
+	R_xlen_t ncigars = XLENGTH(cigars);
+	const int *Lnpos_p = INTEGER(Lnpos);
+	const int *Rnpos_p = INTEGER(Rnpos);
+	CharAE *OP_buf = new_CharAE(0);
+	IntAE *OPL_buf = new_IntAE(0, 0, 0);
+	CharAE *cigar_buf = new_CharAE(0);
+	SEXP clipped_cigars = PROTECT(NEW_CHARACTER(ncigars));
+	SEXP ans_rshift = PROTECT(NEW_INTEGER(ncigars));
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, ncigars));
+	int *rshift_p = INTEGER(ans_rshift);
+	for (R_xlen_t i = 0; i < ncigars; i++) {
+		SEXP cigar_string = STRING_ELT(cigars, i);
+		if (cigar_string == NA_STRING) {
+			SET_STRING_ELT(clipped_cigars, i, NA_STRING);
+			rshift_p[i] = NA_INTEGER;
+			if (errcodes != R_NilValue)
+				INTEGER(errcodes)[i] = CIGAR_IS_NA;
+			continue;
+		}
+		int untouched = 0;
+		const char *errmsg = _tokenize_cigar(CHAR(cigar_string),
+						     OP_buf, OPL_buf);
+		if (errmsg == NULL)
+			errmsg = _softclip_cigar(OP_buf->elts, OPL_buf->elts,
+					IntAE_get_nelt(OPL_buf), along_query,
+					Lnpos_p[i], Rnpos_p[i],
+					cigar_buf, rshift_p + i, &untouched);
+		if (errmsg != NULL) {
+			if (errcodes == R_NilValue) {
+				UNPROTECT(3);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			SET_STRING_ELT(clipped_cigars, i, NA_STRING);
+			rshift_p[i] = NA_INTEGER;
+			INTEGER(errcodes)[i] = _errmsg_as_errcode(errmsg);
+			continue;
+		}
+		if (untouched) {
+			SET_STRING_ELT(clipped_cigars, i, cigar_string);
+			continue;
+		}
+		SEXP clipped_string = PROTECT(mkCharLen(cigar_buf->elts,
+					CharAE_get_nelt(cigar_buf)));
+		SET_STRING_ELT(clipped_cigars, i, clipped_string);
+		UNPROTECT(1);
+	}
+
+	SEXP ans = PROTECT(NEW_LIST(2));
+	SET_VECTOR_ELT(ans, 0, clipped_cigars);
+	SET_VECTOR_ELT(ans, 1, ans_rshift);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(4);
+	return ans;
+}
+
+
+/****************************************************************************
+ * C_softclip_cigars_along_ref() and C_softclip_cigars_along_query()
+ */
+
+/* --- .Call ENTRY POINTS ---
+   Return a list of 2 elements:
+     1. The vector of soft-clipped CIGARs.
+     2. The 'rshift' vector i.e. the integer vector of the same length
+        as 'cigars' that would need to be added to the 'lmmpos' field
+        of a SAM/BAM file as a consequence of this soft-clipping. */
+SEXP C_softclip_cigars_along_ref(SEXP cigars, SEXP Lnpos, SEXP Rnpos,
+		SEXP na_on_error)
+{
+	return softclip_cigars(cigars, Lnpos, Rnpos, na_on_error, 0);
+}
+
+SEXP C_softclip_cigars_along_query(SEXP cigars, SEXP Lnpos, SEXP Rnpos,
+		SEXP na_on_error)
+{
+	return softclip_cigars(cigars, Lnpos, Rnpos, na_on_error, 1);
+}
+
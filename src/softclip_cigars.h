@@ -0,0 +1,35 @@
+#ifndef _SOFTCLIP_CIGARS_H_
+#define _SOFTCLIP_CIGARS_H_
+
+#include <Rdefines.h>
+
+#include "S4Vectors_interface.h"
+
+const char *_softclip_cigar(
+	const char *OPs,
+	const int *OPLs,
+	int nops,
+	int along_query,
+	int Lnpos,
+	int Rnpos,
+	CharAE *cigar_buf,
+	int *rshift,
+	int *untouched
+);
+
+SEXP C_softclip_cigars_along_ref(
+	SEXP cigars,
+	SEXP Lnpos,
+	SEXP Rnpos,
+	SEXP na_on_error
+);
+
+SEXP C_softclip_cigars_along_query(
+	SEXP cigars,
+	SEXP Lnpos,
+	SEXP Rnpos,
+	SEXP na_on_error
+);
+
+#endif  /* _SOFTCLIP_CIGARS_H_ */
+
@@ -3,81 +3,405 @@
 #include "explode_cigars.h"
 
 #include <string.h>  /* for memset() */
+#include <limits.h>  /* for INT_MAX */
 
 
+static const char allOPs[] = "MIDNSHP=X";
+#define ALLOPS_LEN ((int) sizeof(allOPs) - 1)
+
+/* Counts are accumulated in a long long so weighted counts cannot overflow
+   (a CIGAR string would need more than 2^32 operations for that). */
 static const char *cigar_string_op_table(SEXP cigar_string, int weighted,
-		const char *allOPs, int *table_row, int table_nrow)
+		long long *table_row)
 {
-	static char errmsg_buf[200];
-
 	if (cigar_string == NA_STRING)
 		return "CIGAR string is NA";
 	if (LENGTH(cigar_string) == 0)
-		return "CIGAR string is empty";
+		return _empty_cigar_error();
 	const char *cig0 = CHAR(cigar_string);
 	char OP /* Operation */;
-	int n, offset = 0, OPL /* Operation Length */;
+	int n, offset = 0, op_idx = 0, OPL /* Operation Length */;
 	while ((n = _next_cigar_OP(cig0, offset, &OP, &OPL))) {
 		if (n == -1)
 			return _get_cigar_parsing_error();
 		const char *tmp = strchr(allOPs, (int) OP);
-		if (tmp == NULL) {
-			snprintf(errmsg_buf, sizeof(errmsg_buf),
-				 "unknown CIGAR operation '%c' at char %d",
-				 OP, offset + 1);
-			return errmsg_buf;
-		}
-		int *dest_p = table_row + (tmp - allOPs) * table_nrow;
-		*dest_p += weighted ? OPL : 1;
+		if (tmp == NULL)
+			return _unknown_cigar_op_error(OP, op_idx);
+		table_row[tmp - allOPs] += weighted ? OPL : 1;
 		offset += n;
+		op_idx++;
 	}
 	return NULL;
 }
 
+/* Copy 'table_row' to row 'i' of integer or double matrix 'ans'. */
+static void set_table_row(SEXP ans, R_xlen_t i, R_xlen_t nrow,
+		const long long *table_row)
+{
+	for (int j = 0; j < ALLOPS_LEN; j++) {
+		R_xlen_t k = i + j * nrow;
+		if (TYPEOF(ans) == INTSXP)
+			INTEGER(ans)[k] = (int) table_row[j];
+		else
+			REAL(ans)[k] = (double) table_row[j];
+	}
+	return;
+}
+
+static void set_NA_table_row(SEXP ans, R_xlen_t i, R_xlen_t nrow)
+{
+	for (int j = 0; j < ALLOPS_LEN; j++) {
+		R_xlen_t k = i + j * nrow;
+		if (TYPEOF(ans) == INTSXP)
+			INTEGER(ans)[k] = NA_INTEGER;
+		else
+			REAL(ans)[k] = NA_REAL;
+	}
+	return;
+}
+
+static void set_op_colnames(SEXP ans)
+{
+	SEXP ans_colnames = PROTECT(NEW_CHARACTER(ALLOPS_LEN));
+	for (int j = 0; j < ALLOPS_LEN; j++) {
+		SEXP OP = PROTECT(mkCharLen(allOPs + j, 1));
+		SET_STRING_ELT(ans_colnames, j, OP);
+		UNPROTECT(1);
+	}
+	SEXP ans_dimnames = PROTECT(NEW_LIST(2));
+	SET_ELEMENT(ans_dimnames, 0, R_NilValue);
+	SET_ELEMENT(ans_dimnames, 1, ans_colnames);
+	SET_DIMNAMES(ans, ans_dimnames);
+	UNPROTECT(2);
+	return;
+}
+
+
+/****************************************************************************
+ * C_tabulate_cigar_ops()
+ */
+
 /* --- .Call ENTRY POINT ---
  * Args:
  *   cigars: character vector containing the extended CIGAR string for each
  *           read;
+ *   oplens_as_weights: TRUE or FALSE;
+ *   na_on_error: TRUE or FALSE. If TRUE, then the row of a CIGAR that
+ *           cannot be parsed or contains an unknown operation is filled
+ *           with NAs and an error code (see _errmsg_as_errcode()) is
+ *           recorded in the "errcode" attribute of the returned matrix.
+ *           If FALSE, then an error is raised.
  * Return an integer matrix with the number of rows equal to the length of
  * 'cigars' and 9 columns, one for each extended CIGAR operation containing
  * a frequency count for the operations for each element of 'cigars'.
+ * When 'oplens_as_weights' is TRUE, the matrix is turned into a double
+ * matrix as soon as a weighted count that doesn't fit in an int is found.
  */
-SEXP C_tabulate_cigar_ops(SEXP cigars, SEXP oplens_as_weights)
+SEXP C_tabulate_cigar_ops(SEXP cigars, SEXP oplens_as_weights,
+			  SEXP na_on_error)
 {
-	static const char *allOPs = "MIDNSHP=X";
-
-	int cigar_len = LENGTH(cigars);
+	R_xlen_t cigar_len = XLENGTH(cigars);
+	/* The number of rows of a matrix must fit in an int. */
+	if (cigar_len > INT_MAX)
+		_too_many_elements_error("the returned matrix");
 	int weighted = LOGICAL(oplens_as_weights)[0];
-	int allOPs_len = strlen(allOPs);
-	SEXP ans = PROTECT(allocMatrix(INTSXP, cigar_len, allOPs_len));
-	memset(INTEGER(ans), 0, LENGTH(ans) * sizeof(int));
-	int *ans_p = INTEGER(ans);
-	for (int i = 0; i < cigar_len; i++, ans_p++) {
+	SEXP ans;
+	PROTECT_INDEX ans_pidx;
+	PROTECT_WITH_INDEX(ans = allocMatrix(INTSXP, cigar_len, ALLOPS_LEN),
+			   &ans_pidx);
+	memset(INTEGER(ans), 0, XLENGTH(ans) * sizeof(int));
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, cigar_len));
+	long long table_row[ALLOPS_LEN];
+	for (R_xlen_t i = 0; i < cigar_len; i++) {
 		SEXP cigar_string = STRING_ELT(cigars, i);
 		if (cigar_string == NA_STRING) {
-			INTEGER(ans)[i] = NA_INTEGER;
+			if (TYPEOF(ans) == INTSXP)
+				INTEGER(ans)[i] = NA_INTEGER;
+			else
+				REAL(ans)[i] = NA_REAL;
+			if (errcodes != R_NilValue)
+				INTEGER(errcodes)[i] = CIGAR_IS_NA;
 			continue;
 		}
+		memset(table_row, 0, sizeof(table_row));
 		const char *errmsg = cigar_string_op_table(cigar_string,
-							   weighted, allOPs,
-							   ans_p, cigar_len);
+							   weighted, table_row);
 		if (errmsg != NULL) {
-			UNPROTECT(1);
-			error("in 'cigars[%d]': %s", i + 1, errmsg);
+			if (errcodes == R_NilValue) {
+				UNPROTECT(2);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			set_NA_table_row(ans, i, cigar_len);
+			INTEGER(errcodes)[i] = _errmsg_as_errcode(errmsg);
+			continue;
 		}
+		if (TYPEOF(ans) == INTSXP) {
+			for (int j = 0; j < ALLOPS_LEN; j++) {
+				if (table_row[j] > INT_MAX) {
+					/* Switch to a double matrix. */
+					REPROTECT(ans = coerceVector(ans,
+								     REALSXP),
+						  ans_pidx);
+					break;
+				}
+			}
+		}
+		set_table_row(ans, i, cigar_len, table_row);
 	}
 
-	SEXP ans_colnames = PROTECT(NEW_CHARACTER(allOPs_len));
-	for (int j = 0; j < allOPs_len; j++) {
-		SEXP OP = PROTECT(mkCharLen(allOPs + j, 1));
-		SET_STRING_ELT(ans_colnames, j, OP);
-		UNPROTECT(1);
+	set_op_colnames(ans);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(2);
+	return ans;
+}
+
+
+
+/****************************************************************************
+ * C_tabulate_cigar_ops_by_group()
+ */
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   cigars: character vector containing the extended CIGAR string for each
+ *           read;
+ *   group:  NULL or an integer vector parallel to 'cigars' containing the
+ *           1-based group of each CIGAR (typically the codes of a factor).
+ *           CIGARs with an NA group are ignored. If NULL, all the CIGARs
+ *           belong to group 1;
+ *   ngroup: a single integer. The number of groups;
+ *   oplens_as_weights, na_on_error: see C_tabulate_cigar_ops() above.
+ *           If 'na_on_error' is TRUE, the CIGARs that cannot be parsed or
+ *           contain an unknown operation are ignored.
+ * NA CIGARs are ignored.
+ * Returns a double matrix with 1 row per group and 9 columns, one for each
+ * extended CIGAR operation, containing the total counts of the operations
+ * in each group. The per-CIGAR counts are never stored.
+ */
+SEXP C_tabulate_cigar_ops_by_group(SEXP cigars, SEXP group, SEXP ngroup,
+		SEXP oplens_as_weights, SEXP na_on_error)
+{
+	R_xlen_t cigar_len = XLENGTH(cigars);
+	int ngroup0 = INTEGER(ngroup)[0];
+	const int *group_p = group == R_NilValue ? NULL : INTEGER(group);
+	int weighted = LOGICAL(oplens_as_weights)[0];
+
+	/* One table row per group. The tables are stored row by row. */
+	size_t nelt = (size_t) ngroup0 * ALLOPS_LEN;
+	long long *tables = (long long *) R_alloc(nelt, sizeof(long long));
+	memset(tables, 0, nelt * sizeof(long long));
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, cigar_len));
+	for (R_xlen_t i = 0; i < cigar_len; i++) {
+		int g = group_p == NULL ? 1 : group_p[i];
+		if (g == NA_INTEGER)
+			continue;
+		SEXP cigar_string = STRING_ELT(cigars, i);
+		if (cigar_string == NA_STRING) {
+			if (errcodes != R_NilValue)
+				INTEGER(errcodes)[i] = CIGAR_IS_NA;
+			continue;
+		}
+		long long table_row[ALLOPS_LEN];
+		memset(table_row, 0, sizeof(table_row));
+		const char *errmsg = cigar_string_op_table(cigar_string,
+							   weighted, table_row);
+		if (errmsg != NULL) {
+			if (errcodes == R_NilValue) {
+				UNPROTECT(1);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			INTEGER(errcodes)[i] = _errmsg_as_errcode(errmsg);
+			continue;
+		}
+		long long *table = tables + (size_t) (g - 1) * ALLOPS_LEN;
+		for (int j = 0; j < ALLOPS_LEN; j++)
+			table[j] += table_row[j];
 	}
-	SEXP ans_dimnames = PROTECT(NEW_LIST(2));
-	SET_ELEMENT(ans_dimnames, 0, R_NilValue);
-	SET_ELEMENT(ans_dimnames, 1, ans_colnames);
-	SET_DIMNAMES(ans, ans_dimnames);
-	UNPROTECT(3);
+
+	SEXP ans = PROTECT(allocMatrix(REALSXP, ngroup0, ALLOPS_LEN));
+	for (int g = 0; g < ngroup0; g++)
+		for (int j = 0; j < ALLOPS_LEN; j++)
+			REAL(ans)[g + (R_xlen_t) j * ngroup0] =
+				(double) tables[(size_t) g * ALLOPS_LEN + j];
+	set_op_colnames(ans);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(2);
 	return ans;
 }
 
+
+/****************************************************************************
+ * C_tabulate_cigar_oplens()
+ */
+
+/* Lengths > 'max_exact' are counted in log2 bins: bin k contains the
+   lengths L such that floor(log2(L)) == k. */
+#define NLOG2_BINS 32
+
+static int log2_bin(int L)
+{
+	int k = 0;
+	while (L >>= 1)
+		k++;
+	return k;
+}
+
+/* Returns the row of op 'OP' in the histograms, or -1 if 'OP' is not a
+   valid CIGAR operation. */
+static int op_row(char OP)
+{
+	const char *tmp = strchr(allOPs, (int) OP);
+	return tmp == NULL || OP == '\0' ? -1 : (int) (tmp - allOPs);
+}
+
+/* Returns NULL on success, or an error message. The histograms are only
+   updated if the CIGAR is valid. */
+static const char *add_cigar_oplens(const char *cig0,
+		CharAE *OP_buf, IntAE *OPL_buf, int max_exact,
+		long long *exact_hist, long long *binned_hist)
+{
+	const char *errmsg = _tokenize_cigar(cig0, OP_buf, OPL_buf);
+	if (errmsg != NULL)
+		return errmsg;
+	int nops = IntAE_get_nelt(OPL_buf);
+	for (int k = 0; k < nops; k++)
+		if (op_row(OP_buf->elts[k]) == -1)
+			return _unknown_cigar_op_error(OP_buf->elts[k], k);
+	for (int k = 0; k < nops; k++) {
+		int j = op_row(OP_buf->elts[k]), OPL = OPL_buf->elts[k];
+		if (OPL <= max_exact)
+			exact_hist[(size_t) j * max_exact + OPL - 1]++;
+		else
+			binned_hist[j * NLOG2_BINS + log2_bin(OPL)]++;
+	}
+	return NULL;
+}
+
+/* Walks on the histograms of all the groups and returns the number of
+   non-zero counts. If 'ans' is not R_NilValue, the non-zero counts are
+   stored in it. */
+static R_xlen_t collect_oplen_counts(int ngroup, int max_exact,
+		const long long *exact_hists, const long long *binned_hists,
+		SEXP ans)
+{
+	R_xlen_t n = 0;
+	size_t exact_hist_len = (size_t) ALLOPS_LEN * max_exact;
+	size_t binned_hist_len = (size_t) ALLOPS_LEN * NLOG2_BINS;
+	for (int g = 0; g < ngroup; g++) {
+		const long long *exact_hist = exact_hists + g * exact_hist_len;
+		const long long *binned_hist = binned_hists +
+					       g * binned_hist_len;
+		for (int j = 0; j < ALLOPS_LEN; j++) {
+			for (int L = 1; L <= max_exact; L++) {
+				long long count = exact_hist[
+					(size_t) j * max_exact + L - 1];
+				if (count == 0)
+					continue;
+				if (ans != R_NilValue) {
+					INTEGER(VECTOR_ELT(ans, 0))[n] = g + 1;
+					INTEGER(VECTOR_ELT(ans, 1))[n] = j + 1;
+					INTEGER(VECTOR_ELT(ans, 2))[n] = L;
+					INTEGER(VECTOR_ELT(ans, 3))[n] = L;
+					REAL(VECTOR_ELT(ans, 4))[n] =
+							(double) count;
+				}
+				n++;
+			}
+			for (int b = 0; b < NLOG2_BINS; b++) {
+				long long count = binned_hist[j * NLOG2_BINS + b];
+				if (count == 0)
+					continue;
+				if (ans != R_NilValue) {
+					long long from = 1LL << b,
+						  to = (1LL << (b + 1)) - 1;
+					if (from <= max_exact)
+						from = max_exact + 1;
+					if (to > INT_MAX)
+						to = INT_MAX;
+					INTEGER(VECTOR_ELT(ans, 0))[n] = g + 1;
+					INTEGER(VECTOR_ELT(ans, 1))[n] = j + 1;
+					INTEGER(VECTOR_ELT(ans, 2))[n] = (int) from;
+					INTEGER(VECTOR_ELT(ans, 3))[n] = (int) to;
+					REAL(VECTOR_ELT(ans, 4))[n] =
+							(double) count;
+				}
+				n++;
+			}
+		}
+	}
+	return n;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   cigars, group, ngroup, na_on_error: see C_tabulate_cigar_ops_by_group()
+ *           above.
+ *   max_exact: a single non-negative integer. The operation lengths <=
+ *           'max_exact' are counted exactly, the others are counted in
+ *           log2 bins.
+ * Accumulates one histogram of the operation lengths per CIGAR operation
+ * and per group in a single pass on 'cigars'.
+ * Returns a list of 5 parallel vectors with one element per non-zero
+ * count: the 1-based group, the 1-based index of the CIGAR operation in
+ * "MIDNSHP=X", the smallest and biggest lengths of the bin (the same for
+ * exact counts), and the count (as a double).
+ */
+SEXP C_tabulate_cigar_oplens(SEXP cigars, SEXP group, SEXP ngroup,
+		SEXP max_exact, SEXP na_on_error)
+{
+	R_xlen_t cigar_len = XLENGTH(cigars);
+	int ngroup0 = INTEGER(ngroup)[0];
+	int max_exact0 = INTEGER(max_exact)[0];
+	const int *group_p = group == R_NilValue ? NULL : INTEGER(group);
+
+	size_t exact_hist_len = (size_t) ALLOPS_LEN * max_exact0;
+	size_t binned_hist_len = (size_t) ALLOPS_LEN * NLOG2_BINS;
+	/* + 1 so we don't call R_alloc() with 0 when 'max_exact' is 0. */
+	long long *exact_hists = (long long *)
+		R_alloc(ngroup0 * exact_hist_len + 1, sizeof(long long));
+	long long *binned_hists = (long long *)
+		R_alloc(ngroup0 * binned_hist_len, sizeof(long long));
+	memset(exact_hists, 0, ngroup0 * exact_hist_len * sizeof(long long));
+	memset(binned_hists, 0,
+	       ngroup0 * binned_hist_len * sizeof(long long));
+	CharAE *OP_buf = new_CharAE(0);
+	IntAE *OPL_buf = new_IntAE(0, 0, 0);
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, cigar_len));
+	for (R_xlen_t i = 0; i < cigar_len; i++) {
+		int g = group_p == NULL ? 1 : group_p[i];
+		if (g == NA_INTEGER)
+			continue;
+		SEXP cigar_string = STRING_ELT(cigars, i);
+		if (cigar_string == NA_STRING) {
+			if (errcodes != R_NilValue)
+				INTEGER(errcodes)[i] = CIGAR_IS_NA;
+			continue;
+		}
+		const char *errmsg = add_cigar_oplens(CHAR(cigar_string),
+				OP_buf, OPL_buf, max_exact0,
+				exact_hists + (g - 1) * exact_hist_len,
+				binned_hists + (g - 1) * binned_hist_len);
+		if (errmsg != NULL) {
+			if (errcodes == R_NilValue) {
+				UNPROTECT(1);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			INTEGER(errcodes)[i] = _errmsg_as_errcode(errmsg);
+		}
+	}
+
+	R_xlen_t ans_len = collect_oplen_counts(ngroup0, max_exact0,
+				exact_hists, binned_hists, R_NilValue);
+	SEXP ans = PROTECT(NEW_LIST(5));
+	for (int k = 0; k < 4; k++)
+		SET_VECTOR_ELT(ans, k, NEW_INTEGER(ans_len));
+	SET_VECTOR_ELT(ans, 4, NEW_NUMERIC(ans_len));
+	collect_oplen_counts(ngroup0, max_exact0,
+			     exact_hists, binned_hists, ans);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(2);
+	return ans;
+}
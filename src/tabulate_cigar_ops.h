@@ -5,7 +5,24 @@
 
 SEXP C_tabulate_cigar_ops(
 	SEXP cigars,
-	SEXP oplens_as_weights
+	SEXP oplens_as_weights,
+	SEXP na_on_error
+);
+
+SEXP C_tabulate_cigar_ops_by_group(
+	SEXP cigars,
+	SEXP group,
+	SEXP ngroup,
+	SEXP oplens_as_weights,
+	SEXP na_on_error
+);
+
+SEXP C_tabulate_cigar_oplens(
+	SEXP cigars,
+	SEXP group,
+	SEXP ngroup,
+	SEXP max_exact,
+	SEXP na_on_error
 );
 
 #endif  /* _TABULATE_CIGAR_OPS_H_ */
@@ -0,0 +1,39 @@
+#include "test_ccallables.h"
+
+/* Calls the routines of the C interface through R_GetCCallable(), like a
+   package that has cigarillo in its LinkingTo field would do. Only used by
+   the unit tests (see tests/testthat/test-ccallables.R). */
+#include "../inst/include/_cigarillo_stubs.c"
+
+
+/* --- .Call ENTRY POINT ---
+   Returns a list of 2 vectors parallel to 'cigars': the number of CIGAR
+   operations (obtained with split_cigar()) and the extent along 'space'
+   (obtained with cigar_extent()). Both are NA for an NA or invalid CIGAR. */
+SEXP C_test_ccallables(SEXP cigars, SEXP space)
+{
+	R_xlen_t ncigars = XLENGTH(cigars);
+	int space0 = INTEGER(space)[0];
+	SEXP nops = PROTECT(NEW_INTEGER(ncigars));
+	SEXP extents = PROTECT(NEW_NUMERIC(ncigars));
+	for (R_xlen_t i = 0; i < ncigars; i++) {
+		SEXP cigar = STRING_ELT(cigars, i);
+		long long extent;
+		int n;
+		if (cigar == NA_STRING ||
+		    split_cigar(CHAR(cigar), NULL, NULL, 0, &n) != NULL ||
+		    cigar_extent(CHAR(cigar), space0, &extent) != NULL)
+		{
+			INTEGER(nops)[i] = NA_INTEGER;
+			REAL(extents)[i] = NA_REAL;
+			continue;
+		}
+		INTEGER(nops)[i] = n;
+		REAL(extents)[i] = (double) extent;
+	}
+	SEXP ans = PROTECT(NEW_LIST(2));
+	SET_VECTOR_ELT(ans, 0, nops);
+	SET_VECTOR_ELT(ans, 1, extents);
+	UNPROTECT(3);
+	return ans;
+}
@@ -0,0 +1,11 @@
+#ifndef _TEST_CCALLABLES_H_
+#define _TEST_CCALLABLES_H_
+
+#include <Rdefines.h>
+
+SEXP C_test_ccallables(
+	SEXP cigars,
+	SEXP space
+);
+
+#endif  /* _TEST_CCALLABLES_H_ */
@@ -1,189 +1,114 @@
 #include "trim_cigars.h"
 
+#include "cigar_ops_visibility.h"
 #include "explode_cigars.h"
+#include "cigar_extent.h"
+#include "implode_cigars.h"
+#include "softclip_cigars.h"
 
-
-static char errmsg_buf[200];
+#include <string.h>  /* for memset() */
+#include <limits.h>  /* for INT_MAX */
 
 
 /****************************************************************************
- * C_trim_cigars_along_ref()
+ * _trim_cigar()
  */
 
-static const char *Ltrim_along_ref(SEXP cigar_string,
-				   int *Lnpos, int *Loffset, int *rshift)
+static const char *write_trimmed_cigar(const char *OPs, const int *OPLs,
+		int Lnpos, int Lidx, int Rnpos, int Ridx, CharAE *cigar_buf)
 {
-	if (cigar_string == NA_STRING)
-		return "CIGAR string is NA";
-	if (LENGTH(cigar_string) == 0)
-		return "CIGAR string is empty";
-	const char *cig0 = CHAR(cigar_string);
-	*rshift = 0;
-	int n, offset = 0, OPL /* Operation Length */;
-	char OP /* Operation */;
-	while ((n = _next_cigar_OP(cig0, offset, &OP, &OPL))) {
-		if (n == -1)
-			return _get_cigar_parsing_error();
-		switch (OP) {
-		/* Alignment match (can be a sequence match or mismatch) */
-		    case 'M': case '=': case 'X':
-			if (*Lnpos < OPL) {
-				*Loffset = offset;
-				*rshift += *Lnpos;
-				return NULL;
-			}
-			*Lnpos -= OPL;
-			*rshift += OPL;
-		    break;
-		/* Insertion to the reference or soft/hard clip on the read */
-		    case 'I': case 'S': case 'H':
-		    break;
-		/* Deletion (or skipped region) from the reference */
-		    case 'D': case 'N':
-			if (*Lnpos < OPL)
-				*Lnpos = 0;
-			else
-				*Lnpos -= OPL;
-			*rshift += OPL;
-		    break;
-		/* Silent deletion from the padded reference */
-		    case 'P': break;
-		    default:
-			snprintf(errmsg_buf, sizeof(errmsg_buf),
-				 "unknown CIGAR operation '%c' at char %d",
-				 OP, offset + 1);
-			return errmsg_buf;
-		}
-		offset += n;
-	}
-	snprintf(errmsg_buf, sizeof(errmsg_buf),
-		 "CIGAR is empty after trimming");
-	return errmsg_buf;
-}
-
-static const char *Rtrim_along_ref(SEXP cigar_string,
-				   int *Rnpos, int *Roffset)
-{
-	if (cigar_string == NA_STRING)
-		return "CIGAR string is NA";
-	if (LENGTH(cigar_string) == 0)
-		return "CIGAR string is empty";
-	const char *cig0 = CHAR(cigar_string);
-	int n, offset = LENGTH(cigar_string), OPL /* Operation Length */;
-	char OP /* Operation */;
-	while ((n = _prev_cigar_OP(cig0, offset, &OP, &OPL))) {
-		if (n == -1)
-			return _get_cigar_parsing_error();
-		offset -= n;
-		switch (OP) {
-		/* Alignment match (can be a sequence match or mismatch) */
-		    case 'M': case '=': case 'X':
-			if (*Rnpos < OPL) {
-				*Roffset = offset;
-				return NULL;
-			}
-			*Rnpos -= OPL;
-		    break;
-		/* Insertion to the reference or soft/hard clip on the read */
-		    case 'I': case 'S': case 'H':
-		    break;
-		/* Deletion (or skipped region) from the reference */
-		    case 'D': case 'N':
-			if (*Rnpos < OPL)
-				*Rnpos = 0;
-			else
-				*Rnpos -= OPL;
-		    break;
-		/* Silent deletion from the padded reference */
-		    case 'P': break;
-		    default:
-			snprintf(errmsg_buf, sizeof(errmsg_buf),
-				 "unknown CIGAR operation '%c' at char %d",
-				 OP, offset + 1);
-			return errmsg_buf;
-		}
+	CharAE_set_nelt(cigar_buf, 0);
+	for (int i = Lidx; i <= Ridx; i++) {
+		int OPL = OPLs[i];
+		if (i == Lidx)
+			OPL -= Lnpos;
+		if (i == Ridx)
+			OPL -= Rnpos;
+		if (OPL <= 0)
+			return _empty_after_trimming_error();
+		_append_cigar_OP(cigar_buf, OPs[i], OPL);
 	}
-	snprintf(errmsg_buf, sizeof(errmsg_buf),
-		 "CIGAR is empty after trimming");
-	return errmsg_buf;
+	return NULL;
 }
 
-#define	CIGAR_BUF_LENGTH 250000
-
-/* FIXME: 'cigar_buf' is under the risk of a buffer overflow! */
-static const char *trim_along_ref(SEXP cigar_string,
-		int Lnpos, int Rnpos, char *cigar_buf, int *rshift)
+/* Trim the CIGAR operations previously extracted by _tokenize_cigar() and
+   write the operations to keep to 'cigar_buf' with _append_cigar_OP().
+   The Ltrim/Rtrim functions walk on the tokens so the CIGAR string is
+   parsed only once. Both the token buffers and 'cigar_buf' are allocated
+   once per .Call and grow as needed so there is no limit on the length of
+   the CIGAR strings that we can handle.
+   Sets '*untouched' to 1 if the trimming leaves the CIGAR unchanged, in
+   which case nothing is written to 'cigar_buf' and the caller can simply
+   reuse the original string. */
+const char *_trim_cigar(const char *OPs, const int *OPLs, int nops,
+		int along_query, int Lnpos, int Rnpos,
+		CharAE *cigar_buf, int *rshift, int *untouched)
 {
-	//Rprintf("trim_along_ref():\n");
-	int Loffset;
-	const char *errmsg =
-		Ltrim_along_ref(cigar_string, &Lnpos, &Loffset, rshift);
+	int Lidx, Ridx;
+	const char *errmsg = _get_trim_bounds(OPs, OPLs, nops, along_query,
+					      &Lnpos, &Lidx, &Rnpos, &Ridx,
+					      rshift);
 	if (errmsg != NULL)
 		return errmsg;
-	//Rprintf("  Lnpos=%d Loffset=%d *rshift=%d\n",
-	//	Lnpos, Loffset, *rshift);
-	int Roffset;
-	errmsg = Rtrim_along_ref(cigar_string, &Rnpos, &Roffset);
-	if (errmsg != NULL)
-		return errmsg;
-	//Rprintf("  Rnpos=%d Roffset=%d\n", Rnpos, Roffset);
-	if (Roffset < Loffset) {
-		snprintf(errmsg_buf, sizeof(errmsg_buf),
-			 "CIGAR is empty after trimming");
-		return errmsg_buf;
-	}
-	int buf_offset = 0, n;
-	const char *cig0 = CHAR(cigar_string);
-	for (int offset = Loffset; offset <= Roffset; offset += n) {
-		char OP /* Operation */;
-		int OPL /* Operation Length */;
-		n = _next_cigar_OP(cig0, offset, &OP, &OPL);
-		if (offset == Loffset)
-			OPL -= Lnpos;
-		if (offset == Roffset)
-			OPL -= Rnpos;
-		if (OPL <= 0) {
-			snprintf(errmsg_buf, sizeof(errmsg_buf),
-				 "CIGAR is empty after trimming");
-			return errmsg_buf;
-		}
-		size_t size = CIGAR_BUF_LENGTH - buf_offset;
-		int ret = snprintf(cigar_buf + buf_offset, size,
-				   "%d%c", OPL, OP);
-		if (ret >= size) {
-			snprintf(errmsg_buf, sizeof(errmsg_buf),
-				 "'cigar_buf' overflow");
-			return errmsg_buf;
-		}
-		buf_offset += ret;
-	}
-	return NULL;
+	*untouched = Lidx == 0 && Lnpos == 0 && Ridx == nops - 1 && Rnpos == 0;
+	if (*untouched)
+		return NULL;
+	return write_trimmed_cigar(OPs, OPLs, Lnpos, Lidx, Rnpos, Ridx,
+				   cigar_buf);
 }
 
-/* --- .Call ENTRY POINT --- */
-SEXP C_trim_cigars_along_ref(SEXP cigars, SEXP Lnpos, SEXP Rnpos)
+static SEXP trim_cigars(SEXP cigars, SEXP Lnpos, SEXP Rnpos,
+		SEXP na_on_error, int along_query)
 {
-	static char cigar_buf[CIGAR_BUF_LENGTH];
-
-	int ncigars = LENGTH(cigars);
+	R_xlen_t ncigars = XLENGTH(cigars);
+	const int *Lnpos_p = INTEGER(Lnpos);
+	const int *Rnpos_p = INTEGER(Rnpos);
+	CharAE *OP_buf = new_CharAE(0);
+	IntAE *OPL_buf = new_IntAE(0, 0, 0);
+	CharAE *cigar_buf = new_CharAE(0);
 	SEXP trimmed_cigars = PROTECT(NEW_CHARACTER(ncigars));
 	SEXP ans_rshift = PROTECT(NEW_INTEGER(ncigars));
-	for (int i = 0; i < ncigars; i++) {
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, ncigars));
+	int *rshift_p = INTEGER(ans_rshift);
+	for (R_xlen_t i = 0; i < ncigars; i++) {
 		SEXP cigar_string = STRING_ELT(cigars, i);
 		if (cigar_string == NA_STRING) {
 			SET_STRING_ELT(trimmed_cigars, i, NA_STRING);
-			INTEGER(ans_rshift)[i] = NA_INTEGER;
+			rshift_p[i] = NA_INTEGER;
+			if (errcodes != R_NilValue)
+				INTEGER(errcodes)[i] = CIGAR_IS_NA;
 			continue;
 		}
-		const char *errmsg = trim_along_ref(cigar_string,
-					INTEGER(Lnpos)[i],
-					INTEGER(Rnpos)[i],
-					cigar_buf, INTEGER(ans_rshift) + i);
+		const char *errmsg;
+		int untouched = 0;
+		if (LENGTH(cigar_string) == 0) {
+			errmsg = _empty_cigar_error();
+		} else {
+			errmsg = _tokenize_cigar(CHAR(cigar_string),
+						 OP_buf, OPL_buf);
+		}
+		if (errmsg == NULL)
+			errmsg = _trim_cigar(OP_buf->elts, OPL_buf->elts,
+					IntAE_get_nelt(OPL_buf), along_query,
+					Lnpos_p[i], Rnpos_p[i],
+					cigar_buf, rshift_p + i, &untouched);
 		if (errmsg != NULL) {
-			UNPROTECT(2);
-			error("in 'cigars[%d]': %s", i + 1, errmsg);
+			if (errcodes == R_NilValue) {
+				UNPROTECT(3);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			SET_STRING_ELT(trimmed_cigars, i, NA_STRING);
+			rshift_p[i] = NA_INTEGER;
+			INTEGER(errcodes)[i] = _errmsg_as_errcode(errmsg);
+			continue;
 		}
-		SEXP trimmed_string = PROTECT(mkChar(cigar_buf));
+		if (untouched) {
+			SET_STRING_ELT(trimmed_cigars, i, cigar_string);
+			continue;
+		}
+		SEXP trimmed_string = PROTECT(mkCharLen(cigar_buf->elts,
+					CharAE_get_nelt(cigar_buf)));
 		SET_STRING_ELT(trimmed_cigars, i, trimmed_string);
 		UNPROTECT(1);
 	}
@@ -191,193 +116,502 @@ SEXP C_trim_cigars_along_ref(SEXP cigars, SEXP Lnpos, SEXP Rnpos)
 	SEXP ans = PROTECT(NEW_LIST(2));
 	SET_VECTOR_ELT(ans, 0, trimmed_cigars);
 	SET_VECTOR_ELT(ans, 1, ans_rshift);
-	UNPROTECT(3);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(4);
 	return ans;
 }
 
 
 /****************************************************************************
- * C_trim_cigars_along_query()
+ * C_trim_cigars_along_ref() and C_trim_cigars_along_query()
  */
 
-static const char *Ltrim_along_query(SEXP cigar_string,
-				     int *Lnpos, int *Loffset, int *rshift)
+/* --- .Call ENTRY POINT --- */
+SEXP C_trim_cigars_along_ref(SEXP cigars, SEXP Lnpos, SEXP Rnpos,
+		SEXP na_on_error)
 {
-	if (cigar_string == NA_STRING)
-		return "CIGAR string is NA";
-	if (LENGTH(cigar_string) == 0)
-		return "CIGAR string is empty";
-	const char *cig0 = CHAR(cigar_string);
-	*rshift = 0;
-	int n, offset = 0, OPL /* Operation Length */;
-	char OP /* Operation */;
-	while ((n = _next_cigar_OP(cig0, offset, &OP, &OPL))) {
-		if (n == -1)
-			return _get_cigar_parsing_error();
-		switch (OP) {
-		/* Alignment match (can be a sequence match or mismatch) */
-		    case 'M': case '=': case 'X':
-			if (*Lnpos < OPL) {
-				*Loffset = offset;
-				*rshift += *Lnpos;
-				return NULL;
-			}
-			*Lnpos -= OPL;
-			*rshift += OPL;
-		    break;
-		/* Insertion to the reference or soft/hard clip on the read */
-		    case 'I': case 'S': case 'H':
-			if (*Lnpos < OPL) {
-				*Loffset = offset;
-				return NULL;
-			}
-			*Lnpos -= OPL;
-		    break;
-		/* Deletion (or skipped region) from the reference */
-		    case 'D': case 'N':
-			*rshift += OPL;
+	return trim_cigars(cigars, Lnpos, Rnpos, na_on_error, 0);
+}
+
+/* --- .Call ENTRY POINT ---
+   Return a list of 2 elements:
+     1. The vector of trimmed CIGARs.
+     2. The 'rshift' vector i.e. the integer vector of the same length
+        as 'cigars' that would need to be added to the 'lmmpos' field
+        of a SAM/BAM file as a consequence of this trimming. */
+SEXP C_trim_cigars_along_query(SEXP cigars, SEXP Lnpos, SEXP Rnpos,
+		SEXP na_on_error)
+{
+	return trim_cigars(cigars, Lnpos, Rnpos, na_on_error, 1);
+}
+
+
+/****************************************************************************
+ * C_slice_alignments()
+ */
+
+/* Number of query positions (soft clipping included, hard clipping
+   excluded) covered by operations 'from' to 'to'. */
+static const char *query_width(const char *OPs, const int *OPLs,
+		int from, int to, int *width)
+{
+	*width = 0;
+	for (int i = from; i <= to; i++) {
+		switch (OPs[i]) {
+		    case 'M': case '=': case 'X': case 'I': case 'S':
+			*width += OPLs[i];
 		    break;
-		/* Silent deletion from the padded reference */
-		    case 'P': break;
-		    default:
-			snprintf(errmsg_buf, sizeof(errmsg_buf),
-				 "unknown CIGAR operation '%c' at char %d",
-				 OP, offset + 1);
-			return errmsg_buf;
+		    case 'D': case 'N': case 'P': case 'H': break;
+		    default: return _unknown_cigar_op_error(OPs[i], i);
 		}
-		offset += n;
 	}
-	snprintf(errmsg_buf, sizeof(errmsg_buf),
-		 "CIGAR is empty after trimming");
-	return errmsg_buf;
+	return NULL;
 }
 
-static const char *Rtrim_along_query(SEXP cigar_string,
-				     int *Rnpos, int *Roffset)
+static void set_NA_slice(SEXP ans_cigars, int *lmmpos_p,
+		int *qstart_p, int *qwidth_p, R_xlen_t i)
+{
+	SET_STRING_ELT(ans_cigars, i, NA_STRING);
+	lmmpos_p[i] = qstart_p[i] = qwidth_p[i] = NA_INTEGER;
+	return;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   cigars: character vector containing the CIGAR strings.
+ *   lmmpos: integer vector of the same length as 'cigars' (or of length 1)
+ *           containing the 1-based leftmost mapping positions.
+ *   start, end: integer vectors of the same length as 'cigars' (or of
+ *           length 1) containing the reference windows.
+ *   na_on_error: TRUE or FALSE.
+ * Trims each alignment along the reference so that it only covers the
+ * positions in its window. A CIGAR that is "*" is returned as-is.
+ * Returns a list of 4 elements:
+ *   1. The vector of sliced CIGARs.
+ *   2. The new leftmost mapping positions.
+ *   3. The 1-based start of the slice in the query sequence.
+ *   4. The width of the slice in the query sequence.
+ * Alignments with no aligned position in their window get NAs (except for
+ * the "*" CIGAR).
+ */
+SEXP C_slice_alignments(SEXP cigars, SEXP lmmpos, SEXP start, SEXP end,
+		SEXP na_on_error)
 {
-	if (cigar_string == NA_STRING)
-		return "CIGAR string is NA";
-	if (LENGTH(cigar_string) == 0)
-		return "CIGAR string is empty";
-	const char *cig0 = CHAR(cigar_string);
-	int n, offset = LENGTH(cigar_string), OPL /* Operation Length */;
-	char OP /* Operation */;
-	while ((n = _prev_cigar_OP(cig0, offset, &OP, &OPL))) {
-		if (n == -1)
-			return _get_cigar_parsing_error();
-		offset -= n;
-		switch (OP) {
-		/* M, =, X, I, S, H */
-		    case 'M': case '=': case 'X': case 'I': case 'S': case 'H':
-			if (*Rnpos < OPL) {
-				*Roffset = offset;
-				return NULL;
+	R_xlen_t ncigars = XLENGTH(cigars);
+	R_xlen_t lmmpos_len = XLENGTH(lmmpos);
+	R_xlen_t start_len = XLENGTH(start);
+	R_xlen_t end_len = XLENGTH(end);
+	const int *lmmpos_p = INTEGER(lmmpos);
+	const int *start_p = INTEGER(start);
+	const int *end_p = INTEGER(end);
+	CharAE *OP_buf = new_CharAE(0);
+	IntAE *OPL_buf = new_IntAE(0, 0, 0);
+	CharAE *cigar_buf = new_CharAE(0);
+	SEXP ans_cigars = PROTECT(NEW_CHARACTER(ncigars));
+	SEXP ans_lmmpos = PROTECT(NEW_INTEGER(ncigars));
+	SEXP ans_qstart = PROTECT(NEW_INTEGER(ncigars));
+	SEXP ans_qwidth = PROTECT(NEW_INTEGER(ncigars));
+	SEXP errcodes = PROTECT(_new_errcodes(na_on_error, ncigars));
+	int *ans_lmmpos_p = INTEGER(ans_lmmpos);
+	int *qstart_p = INTEGER(ans_qstart);
+	int *qwidth_p = INTEGER(ans_qwidth);
+	for (R_xlen_t i = 0; i < ncigars; i++) {
+		SEXP cigar_string = STRING_ELT(cigars, i);
+		int pos = lmmpos_p[lmmpos_len == 1 ? 0 : i];
+		int wstart = start_p[start_len == 1 ? 0 : i];
+		int wend = end_p[end_len == 1 ? 0 : i];
+		if (cigar_string == NA_STRING) {
+			set_NA_slice(ans_cigars, ans_lmmpos_p,
+				     qstart_p, qwidth_p, i);
+			if (errcodes != R_NilValue)
+				INTEGER(errcodes)[i] = CIGAR_IS_NA;
+			continue;
+		}
+		if (LENGTH(cigar_string) == 1 && CHAR(cigar_string)[0] == '*') {
+			/* Unmapped read: the "*" is returned as-is. */
+			set_NA_slice(ans_cigars, ans_lmmpos_p,
+				     qstart_p, qwidth_p, i);
+			SET_STRING_ELT(ans_cigars, i, cigar_string);
+			continue;
+		}
+		if (pos == NA_INTEGER || wstart == NA_INTEGER ||
+		    wend == NA_INTEGER)
+		{
+			set_NA_slice(ans_cigars, ans_lmmpos_p,
+				     qstart_p, qwidth_p, i);
+			continue;
+		}
+		const char *errmsg;
+		if (LENGTH(cigar_string) == 0) {
+			errmsg = _empty_cigar_error();
+		} else {
+			errmsg = _tokenize_cigar(CHAR(cigar_string),
+						 OP_buf, OPL_buf);
+		}
+		const char *OPs = OP_buf->elts;
+		const int *OPLs = OPL_buf->elts;
+		int nops = IntAE_get_nelt(OPL_buf);
+		int Lnpos = 0, Rnpos = 0, Lidx = 0, Ridx = 0, rshift = 0,
+		    qleft = 0, qwidth = 0;
+		if (errmsg == NULL) {
+			long long read_end = pos - 1LL +
+				_tokens_extent(OPs, OPLs, nops, REFERENCE);
+			if (read_end > INT_MAX) {
+				UNPROTECT(5);
+				error("in 'cigars[%lld]': alignment ends beyond "
+				      "position INT_MAX", (long long) i + 1);
 			}
-			*Rnpos -= OPL;
-		    break;
-		/* Deletion (or skipped region) from the reference,
-		   or silent deletion from the padded reference */
-		    case 'D': case 'N': case 'P':
-		    break;
-		    default:
-			snprintf(errmsg_buf, sizeof(errmsg_buf),
-				 "unknown CIGAR operation '%c' at char %d",
-				 OP, offset + 1);
-			return errmsg_buf;
+			if (wstart > read_end || wend < pos || wend < wstart) {
+				set_NA_slice(ans_cigars, ans_lmmpos_p,
+					     qstart_p, qwidth_p, i);
+				continue;
+			}
+			Lnpos = wstart > pos ? wstart - pos : 0;
+			Rnpos = read_end > wend ? (int) (read_end - wend) : 0;
+			errmsg = _get_trim_bounds(OPs, OPLs, nops, 0,
+						  &Lnpos, &Lidx, &Rnpos, &Ridx,
+						  &rshift);
+			if (errmsg == _empty_after_trimming_error()) {
+				/* The window falls in a deletion or skipped
+				   region. */
+				set_NA_slice(ans_cigars, ans_lmmpos_p,
+					     qstart_p, qwidth_p, i);
+				continue;
+			}
+		}
+		if (errmsg == NULL)
+			errmsg = query_width(OPs, OPLs, 0, Lidx - 1, &qleft);
+		if (errmsg == NULL)
+			errmsg = query_width(OPs, OPLs, Lidx, Ridx, &qwidth);
+		int untouched = Lidx == 0 && Lnpos == 0 &&
+				Ridx == nops - 1 && Rnpos == 0;
+		if (errmsg == NULL && !untouched)
+			errmsg = write_trimmed_cigar(OPs, OPLs, Lnpos, Lidx,
+						     Rnpos, Ridx, cigar_buf);
+		if (errmsg != NULL) {
+			if (errcodes == R_NilValue) {
+				UNPROTECT(5);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			set_NA_slice(ans_cigars, ans_lmmpos_p,
+				     qstart_p, qwidth_p, i);
+			INTEGER(errcodes)[i] = _errmsg_as_errcode(errmsg);
+			continue;
 		}
+		/* Ltrim_along_ref() and Rtrim_along_ref() always stop on an
+		   M, =, or X operation so the remaining positions to trim
+		   are query positions too. */
+		ans_lmmpos_p[i] = pos + rshift;
+		qstart_p[i] = qleft + Lnpos + 1;
+		qwidth_p[i] = qwidth - Lnpos - Rnpos;
+		if (untouched) {
+			SET_STRING_ELT(ans_cigars, i, cigar_string);
+			continue;
+		}
+		SEXP sliced_string = PROTECT(mkCharLen(cigar_buf->elts,
+					CharAE_get_nelt(cigar_buf)));
+		SET_STRING_ELT(ans_cigars, i, sliced_string);
+		UNPROTECT(1);
 	}
-	snprintf(errmsg_buf, sizeof(errmsg_buf),
-		 "CIGAR is empty after trimming");
-	return errmsg_buf;
+
+	SEXP ans = PROTECT(NEW_LIST(4));
+	SET_VECTOR_ELT(ans, 0, ans_cigars);
+	SET_VECTOR_ELT(ans, 1, ans_lmmpos);
+	SET_VECTOR_ELT(ans, 2, ans_qstart);
+	SET_VECTOR_ELT(ans, 3, ans_qwidth);
+	_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(6);
+	return ans;
 }
 
-/* FIXME: 'cigar_buf' is under the risk of a buffer overflow! */
-static const char *trim_along_query(SEXP cigar_string,
-		int Lnpos, int Rnpos, char *cigar_buf, int *rshift)
+
+
+/****************************************************************************
+ * C_trim_alignments_by_quality()
+ */
+
+/* Supported values for the 'method' argument of
+   C_trim_alignments_by_quality(). */
+#define MOTT_TRIMMING    0
+#define WINDOW_TRIMMING  1
+
+/* Modified Mott algorithm: keep the segment of the read that maximizes
+   the sum of (qual - threshold). Nothing is kept if all the qualities are
+   below or equal to 'threshold'. */
+static void mott_trim(const int *quals, int len, int threshold,
+		int *Lnpos, int *Rnpos)
 {
-	//Rprintf("trim_along_query():\n");
-	int Loffset;
-	const char *errmsg =
-		Ltrim_along_query(cigar_string, &Lnpos, &Loffset, rshift);
-	if (errmsg != NULL)
-		return errmsg;
-	//Rprintf("  Lnpos=%d Loffset=%d *rshift=%d\n",
-	//	Lnpos, Loffset, *rshift);
-	int Roffset;
-	errmsg = Rtrim_along_query(cigar_string, &Rnpos, &Roffset);
-	if (errmsg != NULL)
-		return errmsg;
-	//Rprintf("  Rnpos=%d Roffset=%d\n", Rnpos, Roffset);
-	if (Roffset < Loffset) {
-		snprintf(errmsg_buf, sizeof(errmsg_buf),
-			 "CIGAR is empty after trimming");
-		return errmsg_buf;
-	}
-	int buf_offset = 0, n;
-	const char *cig0 = CHAR(cigar_string);
-	for (int offset = Loffset; offset <= Roffset; offset += n) {
-		char OP /* Operation */;
-		int OPL /* Operation Length */;
-		n = _next_cigar_OP(cig0, offset, &OP, &OPL);
-		if (offset == Loffset)
-			OPL -= Lnpos;
-		if (offset == Roffset)
-			OPL -= Rnpos;
-		if (OPL <= 0) {
-			snprintf(errmsg_buf, sizeof(errmsg_buf),
-				 "CIGAR is empty after trimming");
-			return errmsg_buf;
+	long long best = 0, cur = 0;
+	int best_from = 0, best_to = 0, cur_from = 0;
+	for (int i = 0; i < len; i++) {
+		long long score = quals[i] - threshold;
+		if (cur <= 0) {
+			cur = score;
+			cur_from = i;
+		} else {
+			cur += score;
 		}
-		size_t size = CIGAR_BUF_LENGTH - buf_offset;
-		int ret = snprintf(cigar_buf + buf_offset, size,
-				   "%d%c", OPL, OP);
-		if (ret >= size) {
-			snprintf(errmsg_buf, sizeof(errmsg_buf),
-				 "'cigar_buf' overflow");
-			return errmsg_buf;
+		if (cur > best) {
+			best = cur;
+			best_from = cur_from;
+			best_to = i + 1;
 		}
-		buf_offset += ret;
+	}
+	if (best == 0) {
+		*Lnpos = len;
+		*Rnpos = 0;
+		return;
+	}
+	*Lnpos = best_from;
+	*Rnpos = len - best_to;
+	return;
+}
+
+/* Sliding window trimming: the read starts at the first window (from the
+   left) with a mean quality >= 'threshold', and is cut at the first window
+   after that with a mean quality < 'threshold'. Like with Trimmomatic's
+   SLIDINGWINDOW step, the bases at the start of the bad window that are
+   >= 'threshold' are kept. Symmetrically, the bases at the start of the
+   first good window that are < 'threshold' are dropped. */
+static void window_trim(const int *quals, int len, int threshold,
+		int window_size, int *Lnpos, int *Rnpos)
+{
+	int w = window_size < len ? window_size : len;
+	long long min_sum = (long long) threshold * w, sum = 0;
+	int from, to;
+
+	if (len == 0) {
+		*Lnpos = *Rnpos = 0;
+		return;
+	}
+	for (int i = 0; i < w; i++)
+		sum += quals[i];
+	/* Find the first good window. */
+	for (from = 0; sum < min_sum && from + w < len; from++)
+		sum += quals[from + w] - quals[from];
+	if (sum < min_sum) {
+		*Lnpos = len;
+		*Rnpos = 0;
+		return;
+	}
+	/* Find the next bad window. */
+	for (to = from; sum >= min_sum && to + w < len; to++)
+		sum += quals[to + w] - quals[to];
+	if (sum >= min_sum) {
+		to = len;
+	} else {
+		while (to < len && quals[to] >= threshold)
+			to++;
+	}
+	while (from < to && quals[from] < threshold)
+		from++;
+	*Lnpos = from;
+	*Rnpos = len - to;
+	return;
+}
+
+/* Returns NULL on success, or an error message. */
+static const char *decode_quals(SEXP qual_string, int offset, IntAE *qual_buf)
+{
+	int len = LENGTH(qual_string);
+	const char *letters = CHAR(qual_string);
+	IntAE_set_nelt(qual_buf, 0);
+	for (int j = 0; j < len; j++) {
+		int q = (unsigned char) letters[j] - offset;
+		if (q < 0)
+			return "invalid quality letter";
+		IntAE_insert_at(qual_buf, j, q);
 	}
 	return NULL;
 }
 
-/* --- .Call ENTRY POINT ---
-   Return a list of 2 elements:
-     1. The vector of trimmed CIGARs.
-     2. The 'rshift' vector i.e. the integer vector of the same length
-        as 'cigars' that would need to be added to the 'lmmpos' field
-        of a SAM/BAM file as a consequence of this trimming. */
-SEXP C_trim_cigars_along_query(SEXP cigars, SEXP Lnpos, SEXP Rnpos)
+/* Number of query positions covered by the hard clips at the left end
+   (if 'step' is 1) or at the right end (if 'step' is -1) of a CIGAR. */
+static int hard_clips_width(const char *OPs, const int *OPLs, int nops,
+		int step)
 {
-	static char cigar_buf[CIGAR_BUF_LENGTH];
+	int width = 0;
+	for (int i = step == 1 ? 0 : nops - 1;
+	     0 <= i && i < nops && OPs[i] == 'H';
+	     i += step)
+		width += OPLs[i];
+	return width;
+}
 
-	int ncigars = LENGTH(cigars);
-	SEXP trimmed_cigars = PROTECT(NEW_CHARACTER(ncigars));
+/* Trims or soft-clips the first 'Lnpos' and last 'Rnpos' positions of the
+   read sequence from the CIGAR operations previously extracted by
+   _tokenize_cigar(). Returns NULL on success, or an error message. */
+static const char *trim_read(const char *OPs, const int *OPLs, int nops,
+		int Lnpos, int Rnpos, int softclip,
+		CharAE *cigar_buf, int *rshift, int *untouched)
+{
+	if (softclip)
+		return _softclip_cigar(OPs, OPLs, nops, 1, Lnpos, Rnpos,
+				       cigar_buf, rshift, untouched);
+	/* _trim_cigar() counts the hard clips as query positions. */
+	if (Lnpos != 0)
+		Lnpos += hard_clips_width(OPs, OPLs, nops, 1);
+	if (Rnpos != 0)
+		Rnpos += hard_clips_width(OPs, OPLs, nops, -1);
+	return _trim_cigar(OPs, OPLs, nops, 1, Lnpos, Rnpos,
+			   cigar_buf, rshift, untouched);
+}
+
+/* --- .Call ENTRY POINT ---
+ * Args:
+ *   cigars:      character vector containing the CIGAR strings.
+ *   quals:       character vector parallel to 'cigars' containing the
+ *                encoded base qualities of the read sequences (i.e. the
+ *                QUAL field of a SAM file).
+ *   method:      a single integer (see *_TRIMMING above).
+ *   threshold:   a single integer. The quality threshold.
+ *   window_size: a single positive integer. Only used for WINDOW_TRIMMING.
+ *   offset:      a single integer. The ASCII code of quality 0.
+ *   softclip:    TRUE or FALSE. Soft-clip or trim the low quality ends?
+ *   na_on_error: TRUE or FALSE.
+ * The number of positions to remove at each end of a read is derived from
+ * its qualities, then the CIGAR is trimmed (or soft-clipped) in the same
+ * pass. A CIGAR that is "*" is returned as-is. A read whose QUAL is "*"
+ * (no qualities) is not trimmed.
+ * Returns a list of 4 elements:
+ *   1. The vector of trimmed CIGARs.
+ *   2. The 'rshift' vector (see C_trim_cigars_along_query() above).
+ *   3. The 1-based start of the part of each read to keep.
+ *   4. The width of the part of each read to keep (NA for a "*" QUAL).
+ */
+SEXP C_trim_alignments_by_quality(SEXP cigars, SEXP quals, SEXP method,
+		SEXP threshold, SEXP window_size, SEXP offset, SEXP softclip,
+		SEXP na_on_error)
+{
+	R_xlen_t ncigars = XLENGTH(cigars);
+	int method0 = INTEGER(method)[0];
+	int threshold0 = INTEGER(threshold)[0];
+	int window_size0 = INTEGER(window_size)[0];
+	int offset0 = INTEGER(offset)[0];
+	int softclip0 = LOGICAL(softclip)[0];
+	CharAE *OP_buf = new_CharAE(0);
+	IntAE *OPL_buf = new_IntAE(0, 0, 0);
+	CharAE *cigar_buf = new_CharAE(0);
+	IntAE *qual_buf = new_IntAE(0, 0, 0);
+	SEXP ans_cigars = PROTECT(NEW_CHARACTER(ncigars));
 	SEXP ans_rshift = PROTECT(NEW_INTEGER(ncigars));
-	for (int i = 0; i < ncigars; i++) {
+	SEXP ans_qstart = PROTECT(NEW_INTEGER(ncigars));
+	SEXP ans_qwidth = PROTECT(NEW_INTEGER(ncigars));
+	/* A read with no good base is not a problem with its CIGAR: it gets
+	   an NA and is reported in the "errcode" attribute even if
+	   'na_on_error' is FALSE. */
+	int na_on_error0 = LOGICAL(na_on_error)[0];
+	SEXP errcodes = PROTECT(NEW_INTEGER(ncigars));
+	memset(INTEGER(errcodes), 0, ncigars * sizeof(int));
+	int has_errcodes = na_on_error0;
+	int *rshift_p = INTEGER(ans_rshift);
+	int *qstart_p = INTEGER(ans_qstart);
+	int *qwidth_p = INTEGER(ans_qwidth);
+	for (R_xlen_t i = 0; i < ncigars; i++) {
+		/* Derive the trimming from the qualities. A "*" QUAL means
+		   that the qualities were not stored: the read is left
+		   untrimmed and its query width is reported as NA. */
+		SEXP qual_string = STRING_ELT(quals, i);
+		int no_quals = LENGTH(qual_string) == 1 &&
+			       CHAR(qual_string)[0] == '*';
+		int len = 0, Lnpos = 0, Rnpos = 0;
+		const char *errmsg;
+		if (no_quals) {
+			qstart_p[i] = 1;
+			qwidth_p[i] = NA_INTEGER;
+		} else {
+			errmsg = decode_quals(qual_string, offset0, qual_buf);
+			if (errmsg != NULL) {
+				UNPROTECT(5);
+				error("in 'quals[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			len = IntAE_get_nelt(qual_buf);
+			if (method0 == MOTT_TRIMMING)
+				mott_trim(qual_buf->elts, len, threshold0,
+					  &Lnpos, &Rnpos);
+			else
+				window_trim(qual_buf->elts, len, threshold0,
+					    window_size0, &Lnpos, &Rnpos);
+			qstart_p[i] = Lnpos + 1;
+			qwidth_p[i] = len - Lnpos - Rnpos;
+		}
+
+		/* Apply it to the CIGAR. */
 		SEXP cigar_string = STRING_ELT(cigars, i);
 		if (cigar_string == NA_STRING) {
-			SET_STRING_ELT(trimmed_cigars, i, NA_STRING);
-			INTEGER(ans_rshift)[i] = NA_INTEGER;
+			SET_STRING_ELT(ans_cigars, i, NA_STRING);
+			rshift_p[i] = NA_INTEGER;
+			INTEGER(errcodes)[i] = CIGAR_IS_NA;
 			continue;
 		}
-		const char *errmsg = trim_along_query(cigar_string,
-					INTEGER(Lnpos)[i],
-					INTEGER(Rnpos)[i],
-					cigar_buf, INTEGER(ans_rshift) + i);
+		rshift_p[i] = 0;
+		if (LENGTH(cigar_string) == 1 && CHAR(cigar_string)[0] == '*') {
+			SET_STRING_ELT(ans_cigars, i, cigar_string);
+			continue;
+		}
+		if (LENGTH(cigar_string) == 0) {
+			errmsg = _empty_cigar_error();
+		} else {
+			errmsg = _tokenize_cigar(CHAR(cigar_string),
+						 OP_buf, OPL_buf);
+		}
+		int untouched = 1;
+		if (errmsg == NULL) {
+			const char *OPs = OP_buf->elts;
+			const int *OPLs = OPL_buf->elts;
+			int nops = IntAE_get_nelt(OPL_buf);
+			long long qwidth = _tokens_extent(OPs, OPLs, nops,
+							  QUERY);
+			if (!no_quals && qwidth != len) {
+				UNPROTECT(5);
+				error("in 'quals[%lld]': the number of qualities "
+				      "(%d) is not the query extent of the "
+				      "CIGAR (%lld)", (long long) i + 1,
+				      len, qwidth);
+			}
+			if (len != 0 && Lnpos + Rnpos >= len) {
+				SET_STRING_ELT(ans_cigars, i, NA_STRING);
+				rshift_p[i] = NA_INTEGER;
+				INTEGER(errcodes)[i] = CIGAR_NO_GOOD_BASES;
+				has_errcodes = 1;
+				continue;
+			}
+			if (Lnpos != 0 || Rnpos != 0)
+				errmsg = trim_read(OPs, OPLs, nops,
+						   Lnpos, Rnpos, softclip0,
+						   cigar_buf, rshift_p + i,
+						   &untouched);
+		}
 		if (errmsg != NULL) {
-			UNPROTECT(2);
-			error("in 'cigars[%d]': %s", i + 1, errmsg);
+			if (!na_on_error0) {
+				UNPROTECT(5);
+				error("in 'cigars[%lld]': %s",
+				      (long long) i + 1, errmsg);
+			}
+			SET_STRING_ELT(ans_cigars, i, NA_STRING);
+			rshift_p[i] = NA_INTEGER;
+			INTEGER(errcodes)[i] = _errmsg_as_errcode(errmsg);
+			continue;
 		}
-		SEXP trimmed_string = PROTECT(mkChar(cigar_buf));
-		SET_STRING_ELT(trimmed_cigars, i, trimmed_string);
+		if (untouched) {
+			SET_STRING_ELT(ans_cigars, i, cigar_string);
+			continue;
+		}
+		SEXP trimmed_string = PROTECT(mkCharLen(cigar_buf->elts,
+					CharAE_get_nelt(cigar_buf)));
+		SET_STRING_ELT(ans_cigars, i, trimmed_string);
 		UNPROTECT(1);
 	}
 
-	SEXP ans = PROTECT(NEW_LIST(2));
-	SET_VECTOR_ELT(ans, 0, trimmed_cigars);
+	SEXP ans = PROTECT(NEW_LIST(4));
+	SET_VECTOR_ELT(ans, 0, ans_cigars);
 	SET_VECTOR_ELT(ans, 1, ans_rshift);
-	UNPROTECT(3);
+	SET_VECTOR_ELT(ans, 2, ans_qstart);
+	SET_VECTOR_ELT(ans, 3, ans_qwidth);
+	if (has_errcodes)
+		_set_errcodes_attrib(ans, errcodes);
+	UNPROTECT(6);
 	return ans;
 }
-
@@ -3,16 +3,53 @@
 
 #include <Rdefines.h>
 
+#include "S4Vectors_interface.h"
+
+#include "cigar_core.h"
+
+const char *_trim_cigar(
+	const char *OPs,
+	const int *OPLs,
+	int nops,
+	int along_query,
+	int Lnpos,
+	int Rnpos,
+	CharAE *cigar_buf,
+	int *rshift,
+	int *untouched
+);
+
 SEXP C_trim_cigars_along_ref(
 	SEXP cigars,
 	SEXP Lnpos,
-	SEXP Rnpos
+	SEXP Rnpos,
+	SEXP na_on_error
 );
 
 SEXP C_trim_cigars_along_query(
 	SEXP cigars,
 	SEXP Lnpos,
-	SEXP Rnpos
+	SEXP Rnpos,
+	SEXP na_on_error
+);
+
+SEXP C_slice_alignments(
+	SEXP cigars,
+	SEXP lmmpos,
+	SEXP start,
+	SEXP end,
+	SEXP na_on_error
+);
+
+SEXP C_trim_alignments_by_quality(
+	SEXP cigars,
+	SEXP quals,
+	SEXP method,
+	SEXP threshold,
+	SEXP window_size,
+	SEXP offset,
+	SEXP softclip,
+	SEXP na_on_error
 );
 
 #endif  /* _TRIM_CIGARS_H_ */